@@ -1,11 +1,28 @@
 #include <iostream>
 #include "strategies.hpp"
+#include "backtest.hpp"
+#include "sweep.hpp"
 #include <boost/program_options.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/algorithm/string.hpp>
+#include <csignal>
 
 namespace po = boost::program_options;
 
+// The first Ctrl-C or SIGTERM stops the live session cleanly, so that
+// recordings are closed whole; a second one kills the process.
+void stop_on_signal(int signal)
+{
+    DeribitSession::request_stop();
+    std::signal(signal, SIG_DFL);
+}
+
+void handle_stop_signals()
+{
+    std::signal(SIGINT, stop_on_signal);
+    std::signal(SIGTERM, stop_on_signal);
+}
+
 int main(int argc, char** argv)
 {
 
@@ -16,20 +33,45 @@ int main(int argc, char** argv)
     po::options_description opts_desc("Allowed options");
     opts_desc.add_options()
         ("help",            "Produces help message")
-        ("command",         po::value<std::string>()->required(),                                               "Command to run, either MM or Writer")
+        ("command",         po::value<std::string>()->required(),                                               "Command to run, either MM, Backtest, Sweep, Writer or Dump")
         ("live",            po::value<bool>()->default_value(false)->implicit_value(true),                      "Defines if we use the live or de test(default) platform")
+        ("uri",             po::value<std::string>()->default_value(                        ""),                "Server to connect to instead, e.g. wss://127.0.0.1:8443/ws/api/v2 for MockExchange")
         ("client_id",       po::value<std::string>(&settings.client_id)->default_value(     ""),                "Client ID")
         ("client_secret",   po::value<std::string>(&settings.client_secret)->default_value( ""),                "Client Secret")
+        ("async",           po::value<bool>(&settings.async_io)->default_value(false)->implicit_value(true),    "Asynchronous socket I/O with queued order writes")
+        ("order_connection",po::value<bool>(&settings.order_connection)->default_value(true),                   "Separate connection for orders and private channels")
+        ("pipeline",        po::value<bool>(&settings.pipeline)->default_value(false)->implicit_value(true),    "Network and strategy on separate threads")
+        ("io_core",         po::value<int>(&settings.io_core)->default_value(               -1),                "Core to pin the thread reading the socket to")
+        ("strategy_core",   po::value<int>(&settings.strategy_core)->default_value(         -1),                "Core to pin the strategy thread to")
+        ("spin",            po::value<bool>(&settings.spin)->default_value(false)->implicit_value(true),        "Busy-poll the socket instead of blocking on reads")
+        ("busy_poll",       po::value<int>(&settings.busy_poll_us)->default_value(          0),                 "SO_BUSY_POLL time in microseconds, with --spin")
+        ("credits",         po::value<double>(&settings.credits)->default_value(            50000),             "Order credits of the account")
+        ("credit_refill",   po::value<double>(&settings.credit_refill)->default_value(      10000),             "Order credits refilled per second")
+        ("order_credits",   po::value<double>(&settings.order_credits)->default_value(      500),               "Order credits each buy, sell and edit costs")
+        ("reconnect",       po::value<bool>(&settings.reconnect)->default_value(true),                          "Reconnect when the connection drops")
+        ("mlock",           po::value<bool>(&settings.lock_memory)->default_value(false)->implicit_value(true), "Lock the process memory in RAM")
+        ("replay",          po::value<std::string>(&settings.replay)->default_value(        ""),                "Recording to run the strategy on instead of connecting")
+        ("replay_speed",    po::value<double>(&settings.replay_speed)->default_value(       0),                 "Replay speed against the recorded times, 0 for as fast as possible")
+        ("replay_from",     po::value<double>(&settings.replay_from)->default_value(        0),                 "Seconds into the recording to start the replay or dump from")
 
         ("channels",        po::value<std::vector<std::string>>(),                                              "Channels to subscribe")
         ("output,o",        po::value<std::string>()->default_value(""),                                        "Output file")
+        ("direct_io",       po::value<bool>()->default_value(false)->implicit_value(true),                      "Write recordings bypassing the page cache")
+        ("record_tsc",      po::value<bool>()->default_value(false)->implicit_value(true),                      "Record time stamp counters with the receive times (LAYMANHFT_TSC builds)")
+        ("split_channels",  po::value<bool>()->default_value(false)->implicit_value(true),                      "Record one segment file per channel, listed in the output file")
+        ("input,i",         po::value<std::string>()->default_value(""),                                        "Recording to read")
+        ("sweep",           po::value<std::vector<std::string>>()->multitoken(),                                "Parameter values to backtest, e.g. min_depth=10,20,40")
+        ("threads",         po::value<unsigned>()->default_value(                           0),                 "Sweep threads, 0 for one per core")
 
         ("instrument",      po::value<std::string>(&params.instrument)->default_value(      "BTC-PERPETUAL"),   "Instrument to trade")
         ("min_depth",       po::value<double>(&params.min_depth),                                               "Minimum depth")
         ("mid_depth",       po::value<double>(&params.mid_depth),                                               "Mean depth")
         ("max_depth",       po::value<double>(&params.max_depth),                                               "Maximum depth")
+        ("levels",          po::value<int>(&params.levels)->default_value(                  1),                 "Orders quoted per side")
+        ("level_spacing",   po::value<double>(&params.level_spacing)->default_value(        0),                 "Depth between the levels of a side")
         ("order_amount",    po::value<double>(&params.order_amount),                                            "Standard Order Amount")
         ("max_position_usd",po::value<double>(&params.max_position_usd),                                        "Maximum allowed position (in USD)")
+        ("tick_size",       po::value<double>(&params.tick_size)->default_value(            0.5),               "Instrument tick size")
         ;
     
     po::positional_options_description pos_opts_desc;
@@ -50,31 +92,94 @@ int main(int argc, char** argv)
     po::notify(opts_var_map);
 
     std::string command = boost::algorithm::to_lower_copy(opts_var_map["command"].as<std::string>());
-    settings.uri = parseURI(opts_var_map["live"].as<bool>() ?
+    const std::string& uri = opts_var_map["uri"].as<std::string>();
+    settings.uri = parseURI(!uri.empty() ? uri : opts_var_map["live"].as<bool>() ?
         "wss://www.deribit.com/ws/api/v2" :
         "wss://test.deribit.com/ws/api/v2"
     );
 
     if (command == "mm")
     {
-        if (settings.client_id.empty())
+        if (settings.client_id.empty() && settings.replay.empty())
         {
             std::cout << "client_id and client_secret need to be provided" << std::endl;
             return EXIT_FAILURE;
         }
 
+        handle_stop_signals();
         std::make_shared<SimpleMM>(settings, params)->run();
     }
+    else if (command == "backtest")
+    {
+        // the strategy against a simulated exchange fed by the recording
+        settings.replay = opts_var_map["input"].as<std::string>();
+        if (settings.replay.empty())
+        {
+            std::cout << "input needs to be provided" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        auto mm = std::make_shared<SimpleMM>(settings, params);
+        Backtest backtest(*mm->replay(), params.instrument);
+        mm->run();
+        backtest.print_report();
+    }
+    else if (command == "sweep")
+    {
+        // every combination of the swept values, backtested in parallel
+        const std::string& fname = opts_var_map["input"].as<std::string>();
+        if (fname.empty())
+        {
+            std::cout << "input needs to be provided" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        const std::vector<Strategy_Params> grid = Sweep::grid(params, opts_var_map.count("sweep") ?
+            opts_var_map["sweep"].as<std::vector<std::string>>() : std::vector<std::string>());
+        Sweep sweep(fname, settings, opts_var_map["threads"].as<unsigned>());
+        std::cout << "Backtesting " << grid.size() << " parameter sets" << std::endl;
+        Sweep::print(sweep.run(grid));
+    }
     else if (command == "writer")
     {
         const std::string& fname = opts_var_map["output"].as<std::string>();
         const auto& channels = opts_var_map["channels"].as<std::vector<std::string>>();
         
-        std::make_shared<SubscriptionWriter>(settings.uri, fname, channels)->run();
+#ifndef LAYMANHFT_TSC
+        if (opts_var_map["record_tsc"].as<bool>())
+        {
+            throw std::runtime_error("--record_tsc needs a build with LAYMANHFT_TSC defined");
+        }
+#endif
+        handle_stop_signals();
+        std::make_shared<SubscriptionWriter>(settings.uri, fname, channels, params.tick_size,
+            opts_var_map["direct_io"].as<bool>(), opts_var_map["record_tsc"].as<bool>(),
+            opts_var_map["split_channels"].as<bool>())->run();
+    }
+    else if (command == "dump")
+    {
+        // prints a recording, one notification per line
+        Replay replay(opts_var_map["input"].as<std::string>(), 0, settings.replay_from);
+        while (const Record* record = replay.next())
+        {
+            if (record->checkpoint)
+            {
+                continue;
+            }
+            if (record->type == RecordType::Book)
+            {
+                std::cout << record->received.ns << " " << replay.channel_name(record->channel) << " " << record->book << "\n";
+            }
+            else if (record->type == RecordType::Json)
+            {
+                std::cout << record->received.ns << " " << replay.channel_name(record->channel) << " ";
+                std::cout.write(record->json, record->json_length) << "\n";
+            }
+        }
     }
     else
     {
-        std::cout << "Invalid command. Valid commands are: mm, writer" << std::endl;
+        std::cout << "Invalid command. Valid commands are: mm, backtest, sweep, writer, dump" << std::endl;
     }
     
     return EXIT_SUCCESS;
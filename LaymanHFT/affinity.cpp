@@ -0,0 +1,49 @@
+#include "affinity.hpp"
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+
+bool pin_thread(int core)
+{
+    if (core < 0)
+    {
+        return true;
+    }
+
+#ifdef _WIN32
+    bool pinned = SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+#else
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    bool pinned = sched_setaffinity(0, sizeof(cpus), &cpus) == 0;     // 0 = calling thread
+#endif
+
+    if (!pinned)
+    {
+        std::cout << "Could not pin thread to core " << core << std::endl;
+    }
+    return pinned;
+}
+
+bool lock_memory()
+{
+#ifdef _WIN32
+    // no process-wide equivalent, pages are only locked region by region
+    std::cout << "Memory locking is not supported on this platform" << std::endl;
+    return false;
+#else
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        std::cout << "Could not lock memory (RLIMIT_MEMLOCK too low?)" << std::endl;
+        return false;
+    }
+    return true;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+#pragma once
+
+
+// Restricts the calling thread to one core. Negative cores leave the
+// thread where it is; returns false if the system refused.
+bool pin_thread(int core);
+
+// Locks the current and future pages of the process in memory, so that the
+// hot path never takes a page fault; returns false if the system refused.
+bool lock_memory();
\ No newline at end of file
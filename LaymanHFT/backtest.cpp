@@ -0,0 +1,556 @@
+#include "backtest.hpp"
+#include "request.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+
+Backtest::Backtest(Replay& replay, const std::string& instrument) :
+    _replay(replay),
+    _instrument(instrument),
+    _book_channel(false),
+    _tick_size(0),
+    _change_id(0),
+    _next_order(1),
+    _next_trade(1),
+    _last_ns(replay.now().ns),
+    _first_ns(replay.now().ns),
+    _position_time(0),
+    _mid(0)
+{
+    _replay.observe([this](const Record& record) { this->on_record(record); });
+
+    // answers the requests sent so far right away
+    _replay.capture_with([this](const std::string& msg) { this->on_request(msg); });
+}
+
+Backtest::Report Backtest::report() const
+{
+    Report report = _report;
+    const int64_t span = _last_ns - _first_ns;
+    report.mean_position = (span > 0) ? _position_time / span : 0;
+    report.pnl = report.cash - ((_mid > 0) ? report.position / _mid : 0);
+    return report;
+}
+
+void Backtest::print_report() const
+{
+    const Report report = this->report();
+    std::cout << "Backtest: " << report.orders << " orders, " << report.edits << " edits, "
+        << report.filled_orders << " filled ("
+        << (report.orders > 0 ? 100.0 * report.filled_orders / report.orders : 0) << "%), "
+        << report.fills << " fills, " << report.volume << " traded, " << report.gaps << " book gaps" << std::endl;
+    std::cout << "Position " << report.position << " (max " << report.max_position
+        << ", mean " << report.mean_position << "), PnL " << report.pnl
+        << " (cash " << report.cash << ")" << std::endl;
+}
+
+// ---------------------------------------------------------------
+// market data
+// ---------------------------------------------------------------
+
+void Backtest::on_record(const Record& record)
+{
+    if (record.type == RecordType::Channel)
+    {
+        if (static_cast<size_t>(record.channel) >= _channels.size())
+        {
+            _channels.resize(record.channel + 1, ChannelKind::Other);
+        }
+
+        // the first book channel of the instrument, whatever its interval
+        const std::string& name = _replay.channel_name(record.channel);
+        if (!_book_channel && (name.compare(0, 5 + _instrument.size() + 1, "book." + _instrument + ".") == 0))
+        {
+            _channels[record.channel] = ChannelKind::Book;
+            _book_channel = true;
+            _tick_size = _replay.tick_size(record.channel);
+        }
+        else if (name.compare(0, 7 + _instrument.size() + 1, "trades." + _instrument + ".") == 0)
+        {
+            _channels[record.channel] = ChannelKind::Trades;
+        }
+        return;
+    }
+
+    if (record.checkpoint)
+    {
+        // restarts the book where a gap left it stale
+        if ((_channels[record.channel] == ChannelKind::Book) && _book.stale())
+        {
+            this->on_book(record.book);
+        }
+        return;
+    }
+
+    _position_time += std::abs(_report.position) * (record.received.ns - _last_ns);
+    _last_ns = record.received.ns;
+
+    if (_channels[record.channel] == ChannelKind::Book)
+    {
+        this->on_book(record.book);
+    }
+    else if (_channels[record.channel] == ChannelKind::Trades)
+    {
+        this->on_trades(record.json, record.json_length);
+    }
+}
+
+void Backtest::on_book(const BookDelta& delta)
+{
+    const bool stale = _book.stale();
+    _book.update(delta);
+    if (_book.stale())
+    {
+        // until the next snapshot or checkpoint
+        if (!stale)
+        {
+            _report.gaps++;
+        }
+        return;
+    }
+    _change_id = delta.change_id;
+
+    const auto& bids = _book.bids.levels();
+    const auto& asks = _book.asks.levels();
+    if (!bids.empty() && !asks.empty())
+    {
+        _mid = (bids.begin()->first + asks.begin()->first) / 2;
+    }
+
+    for (SimOrder& order : _orders)
+    {
+        // cancellations along the queue, in proportion
+        const double level = order.buy ? _book.bids.quantity(order.price) : _book.asks.quantity(order.price);
+        if (level < order.level)
+        {
+            order.ahead = (order.level > 0) ? order.ahead * level / order.level : 0;
+        }
+        order.level = level;
+
+        const bool reached = order.buy ?
+            (!asks.empty() && (asks.begin()->first <= order.price)) :
+            (!bids.empty() && (bids.begin()->first >= order.price));
+        if (reached)
+        {
+            this->fill(order, order.price, order.amount - order.filled, true);
+        }
+    }
+    this->remove_filled();
+}
+
+void Backtest::on_trades(const char* json, size_t length)
+{
+    if (_orders.empty())
+    {
+        return;
+    }
+
+    _trades_text.assign(json, length);
+    _trades.ParseInsitu(&_trades_text[0]);
+    if (_trades.HasParseError() || !_trades.IsArray())
+    {
+        return;
+    }
+
+    for (auto it = _trades.Begin(); it != _trades.End(); ++it)
+    {
+        const auto& trade = *it;
+        const double price = trade["price"].GetDouble();
+        const double amount = trade["amount"].GetDouble();
+        const bool taker_buy = std::strcmp(trade["direction"].GetString(), "buy") == 0;
+
+        for (SimOrder& order : _orders)
+        {
+            if ((order.buy == taker_buy) || (order.filled >= order.amount))
+            {
+                continue;
+            }
+
+            const bool through = order.buy ? (price < order.price) : (price > order.price);
+            if (through)
+            {
+                this->fill(order, order.price, order.amount - order.filled, true);
+            }
+            else if (price == order.price)
+            {
+                // the book update that follows shows the level smaller by as much
+                const double reaching = amount - order.ahead;
+                order.ahead = std::max(0.0, order.ahead - amount);
+                order.level = std::max(0.0, order.level - amount);
+                if (reaching > 0)
+                {
+                    this->fill(order, order.price, std::min(reaching, order.amount - order.filled), true);
+                }
+            }
+        }
+    }
+    this->remove_filled();
+}
+
+// ---------------------------------------------------------------
+// orders
+// ---------------------------------------------------------------
+
+void Backtest::place(SimOrder& order)
+{
+    const auto& bids = _book.bids.levels();
+    const auto& asks = _book.asks.levels();
+    const bool crossing = order.buy ?
+        (!asks.empty() && (asks.begin()->first <= order.price)) :
+        (!bids.empty() && (bids.begin()->first >= order.price));
+
+    if (crossing && order.post_only)
+    {
+        order.price = order.buy ? asks.begin()->first - _tick_size : bids.begin()->first + _tick_size;
+    }
+    else if (crossing)
+    {
+        this->fill(order, order.buy ? asks.begin()->first : bids.begin()->first, order.amount - order.filled, false);
+        return;
+    }
+
+    order.level = order.buy ? _book.bids.quantity(order.price) : _book.asks.quantity(order.price);
+    order.ahead = order.level;
+}
+
+void Backtest::fill(SimOrder& order, double price, double amount, bool maker)
+{
+    if (amount <= 0)
+    {
+        return;
+    }
+
+    order.filled += amount;
+    const double signed_amount = order.buy ? amount : -amount;
+    _report.fills++;
+    _report.volume += amount;
+    _report.position += signed_amount;
+    _report.cash += signed_amount / price;
+    _report.max_position = std::max(_report.max_position, std::abs(_report.position));
+    if (order.filled >= order.amount)
+    {
+        _report.filled_orders++;
+    }
+
+    if (_changes_channel.empty())
+    {
+        return;
+    }
+
+    const OrderFields fields = this->order_fields(order, order.filled >= order.amount ? "filled" : "open");
+    const std::string trade_id = std::to_string(_next_trade++);
+
+    TradeFields trade;
+    trade.trade_id = trade_id.c_str();
+    trade.order = &fields;
+    trade.price = price;
+    trade.amount = amount;
+    trade.maker = maker;
+
+    _out.Clear();
+    JsonWriter w(_out);
+    write_changes(w, _changes_channel.c_str(), trade, _report.position);
+    _replay.inject(std::string(_out.GetString(), _out.GetSize()));
+}
+
+void Backtest::remove_filled()
+{
+    _orders.erase(std::remove_if(_orders.begin(), _orders.end(),
+        [](const SimOrder& order) { return order.filled >= order.amount; }), _orders.end());
+}
+
+Backtest::SimOrder* Backtest::find(const std::string& order_id)
+{
+    for (SimOrder& order : _orders)
+    {
+        if (order.order_id == order_id)
+        {
+            return &order;
+        }
+    }
+    return nullptr;
+}
+
+// ---------------------------------------------------------------
+// requests
+// ---------------------------------------------------------------
+
+void Backtest::on_request(const std::string& msg)
+{
+    _request.Parse(msg.c_str());
+    if (_request.HasParseError() || !_request.IsObject() ||
+        !_request.HasMember("method") || !_request["method"].IsString())
+    {
+        return;
+    }
+
+    const int64_t id = (_request.HasMember("id") && _request["id"].IsInt64()) ? _request["id"].GetInt64() : 0;
+    const std::string name = _request["method"].GetString();
+    const rapidjson::Value no_params(rapidjson::kObjectType);
+    const rapidjson::Value& params = (_request.HasMember("params") && _request["params"].IsObject()) ?
+        _request["params"] : no_params;
+
+    const Method method = method_from_name(name);
+    if (((method == Method::PrivateBuy) || (method == Method::PrivateSell) ||
+        (method == Method::PrivateGetPosition) || (method == Method::PrivateGetOpenOrdersByInstrument)) &&
+        (string_param(params, "instrument_name") != _instrument))
+    {
+        this->error(id, 10020, "Only the backtested instrument is traded");
+        return;
+    }
+
+    _out.Clear();
+    JsonWriter w(_out);
+
+    switch (method)
+    {
+    case Method::PublicAuth:
+        begin_response(w, id);
+        w.StartObject();
+        w.Key("access_token");
+        w.String("backtest");
+        w.Key("refresh_token");
+        w.String("backtest");
+        w.Key("expires_in");
+        w.Int(900);
+        w.EndObject();
+        break;
+
+    case Method::PublicSubscribe:
+    {
+        const std::string prefix = "user.changes." + _instrument + ".";
+        begin_response(w, id);
+        w.StartArray();
+        if (params.HasMember("channels") && params["channels"].IsArray())
+        {
+            const auto& channels = params["channels"];
+            for (auto it = channels.Begin(); it != channels.End(); ++it)
+            {
+                if (!it->IsString())
+                {
+                    continue;
+                }
+                if (std::strncmp(it->GetString(), prefix.c_str(), prefix.size()) == 0)
+                {
+                    _changes_channel = it->GetString();
+                }
+                w.String(it->GetString());
+            }
+        }
+        w.EndArray();
+        break;
+    }
+
+    case Method::PublicSetHeartbeat:
+        begin_response(w, id);
+        w.String("ok");
+        break;
+
+    case Method::PublicTest:
+        begin_response(w, id);
+        w.StartObject();
+        w.Key("version");
+        w.String("backtest");
+        w.EndObject();
+        break;
+
+    case Method::PublicGetTime:
+        begin_response(w, id);
+        w.Int64(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        break;
+
+    case Method::PublicGetOrderBook:
+        begin_response(w, id);
+        w.StartObject();
+        w.Key("instrument_name");
+        w.String(_instrument.c_str());
+        w.Key("change_id");
+        w.Int64(_change_id);
+        w.Key("bids");
+        w.StartArray();
+        for (const auto& level : _book.bids.levels())
+        {
+            w.StartArray();
+            w.Double(level.first);
+            w.Double(level.second);
+            w.EndArray();
+        }
+        w.EndArray();
+        w.Key("asks");
+        w.StartArray();
+        for (const auto& level : _book.asks.levels())
+        {
+            w.StartArray();
+            w.Double(level.first);
+            w.Double(level.second);
+            w.EndArray();
+        }
+        w.EndArray();
+        w.EndObject();
+        break;
+
+    case Method::PrivateBuy:
+    case Method::PrivateSell:
+    {
+        SimOrder order;
+        order.order_id = "BT-" + std::to_string(_next_order++);
+        order.label = string_param(params, "label");
+        order.buy = (method == Method::PrivateBuy);
+        order.post_only = bool_param(params, "post_only");
+        order.price = number_param(params, "price");
+        order.amount = number_param(params, "amount");
+        order.filled = 0;
+        if (!(order.price > 0) || !(order.amount > 0))
+        {
+            this->error(id, -32602, "Invalid params");
+            return;
+        }
+
+        _report.orders++;
+        this->place(order);
+        const bool open = order.filled < order.amount;
+        if (open)
+        {
+            _orders.push_back(order);
+        }
+        this->respond_order(id, order, open ? "open" : "filled");
+        return;
+    }
+
+    case Method::PrivateEdit:
+    {
+        SimOrder* order = this->find(string_param(params, "order_id"));
+        const double amount = number_param(params, "amount");
+        const double price = number_param(params, "price");
+        if (order == nullptr)
+        {
+            this->error(id, 11044, "not_open_order");
+            return;
+        }
+        if (!(price > 0) || !(amount > 0))
+        {
+            this->error(id, -32602, "Invalid params");
+            return;
+        }
+
+        _report.edits++;
+        if (amount <= order->filled)
+        {
+            order->amount = order->filled;
+            const SimOrder done = *order;
+            this->remove_filled();
+            this->respond_order(id, done, "filled");
+            return;
+        }
+
+        // the queue position only survives a smaller amount at the same price
+        const bool requeue = (price != order->price) || (amount > order->amount);
+        order->price = price;
+        order->amount = amount;
+        if (requeue)
+        {
+            this->place(*order);
+        }
+
+        const SimOrder edited = *order;
+        const bool open = edited.filled < edited.amount;
+        this->remove_filled();
+        this->respond_order(id, edited, open ? "open" : "filled");
+        return;
+    }
+
+    case Method::PrivateGetPosition:
+        begin_response(w, id);
+        w.StartObject();
+        w.Key("instrument_name");
+        w.String(_instrument.c_str());
+        w.Key("kind");
+        w.String("future");
+        w.Key("size");
+        w.Double(_report.position);
+        w.Key("direction");
+        w.String(_report.position > 0 ? "buy" : (_report.position < 0 ? "sell" : "zero"));
+        w.EndObject();
+        break;
+
+    case Method::PrivateGetOpenOrdersByInstrument:
+        begin_response(w, id);
+        w.StartArray();
+        for (const SimOrder& order : _orders)
+        {
+            write_order(w, this->order_fields(order, "open"));
+        }
+        w.EndArray();
+        break;
+
+    case Method::PrivateCancel:
+    {
+        SimOrder* order = this->find(string_param(params, "order_id"));
+        if (order == nullptr)
+        {
+            this->error(id, 11044, "not_open_order");
+            return;
+        }
+        const SimOrder cancelled = *order;
+        _orders.erase(_orders.begin() + (order - _orders.data()));
+
+        begin_response(w, id);
+        write_order(w, this->order_fields(cancelled, "cancelled"));
+        break;
+    }
+
+    default:
+        this->error(id, -32601, "Method not found");
+        return;
+    }
+
+    this->send(w);
+}
+
+void Backtest::respond_order(int64_t id, const SimOrder& order, const char* state)
+{
+    _out.Clear();
+    JsonWriter w(_out);
+    begin_response(w, id);
+    w.StartObject();
+    w.Key("order");
+    write_order(w, this->order_fields(order, state));
+    w.Key("trades");
+    w.StartArray();
+    w.EndArray();
+    w.EndObject();
+    this->send(w);
+}
+
+void Backtest::error(int64_t id, int code, const char* message)
+{
+    _out.Clear();
+    JsonWriter w(_out);
+    write_error(w, id, code, message);
+    _replay.inject(std::string(_out.GetString(), _out.GetSize()));
+}
+
+void Backtest::send(JsonWriter& w)
+{
+    end_response(w);
+    _replay.inject(std::string(_out.GetString(), _out.GetSize()));
+}
+
+OrderFields Backtest::order_fields(const SimOrder& order, const char* state) const
+{
+    OrderFields fields;
+    fields.order_id = order.order_id.c_str();
+    fields.instrument = _instrument.c_str();
+    fields.buy = order.buy;
+    fields.state = state;
+    fields.price = order.price;
+    fields.amount = order.amount;
+    fields.filled = order.filled;
+    fields.post_only = order.post_only;
+    fields.label = order.label.c_str();
+    return fields;
+}
\ No newline at end of file
@@ -0,0 +1,127 @@
+#pragma once
+#include "book.hpp"
+#include "jsonrpc.hpp"
+#include "replay.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Simulated exchange for a replayed session trading one instrument. It
+// answers the requests the session sends, without latency, and fills its
+// limit orders against the recorded book, sending the fills on the
+// user.changes channel.
+//
+// An order joins the back of the queue at its price: the quantity shown
+// there is ahead of it. When the level shrinks, the cancellations are
+// assumed to be spread evenly along the queue, so the quantity ahead
+// shrinks in proportion; orders joining later queue behind. Trades at the
+// order price, if a trades channel was recorded, consume the quantity ahead
+// first and then fill the order. An order is filled in full when the other
+// side of the book reaches its price, or a trade goes through it.
+//
+// A gap in the recorded book changes leaves the book stale, and nothing
+// fills against it until the next snapshot or checkpoint restarts it.
+//
+// Amounts are in USD and prices in USD per coin, as on inverse contracts,
+// so the PnL is in coin.
+class Backtest
+{
+public:
+    struct Report
+    {
+        size_t orders = 0;          // new orders accepted
+        size_t edits = 0;
+        size_t filled_orders = 0;   // orders filled in full
+        size_t fills = 0;
+        double volume = 0;          // amount traded
+        double position = 0;
+        double max_position = 0;    // largest absolute position
+        double mean_position = 0;   // absolute, weighted by recorded time
+        double cash = 0;            // coin received less coin paid
+        double pnl = 0;             // cash plus the position marked to mid
+        size_t gaps = 0;            // in the book changes
+    };
+
+    Backtest(
+        Replay&,
+        const std::string&          // instrument
+    );
+
+    Report report() const;
+    void print_report() const;
+
+private:
+    enum class ChannelKind : unsigned char
+    {
+        Other,
+        Book,
+        Trades
+    };
+
+    struct SimOrder
+    {
+        std::string order_id;
+        std::string label;
+        bool buy;
+        bool post_only;
+        double price;
+        double amount;
+        double filled;
+        double ahead;               // quantity queued before the order
+        double level;               // quantity shown at its price, as last seen
+    };
+
+    Replay& _replay;
+    std::string _instrument;
+    std::string _changes_channel;   // as subscribed, empty until then
+    std::vector<ChannelKind> _channels;
+    bool _book_channel;             // found in the recording
+    double _tick_size;
+    Book _book;
+    int64_t _change_id;
+    std::vector<SimOrder> _orders;  // open
+    uint64_t _next_order;
+    uint64_t _next_trade;
+
+    Report _report;
+    int64_t _last_ns;               // of the last record, for the time weights
+    int64_t _first_ns;
+    double _position_time;          // absolute position times ns
+    double _mid;
+
+    rapidjson::Document _request;
+    rapidjson::Document _trades;
+    std::string _trades_text;
+    rapidjson::StringBuffer _out;
+
+    void on_record(const Record&);
+    void on_book(const BookDelta&);
+    void on_trades(const char*, size_t);
+    void on_request(const std::string&);
+
+    // places a new order or reprices one, at the back of its queue; post-
+    // only orders are moved off the other side, others take it
+    void place(SimOrder&);
+
+    // fills what is left of the order, or part of it, and notifies it
+    void fill(
+        SimOrder&,
+        double,                     // price
+        double,                     // amount
+        bool                        // resting, rather than taking
+    );
+    void remove_filled();
+
+    SimOrder* find(const std::string&);
+
+    void respond_order(int64_t, const SimOrder&, const char*);
+    void error(int64_t, int, const char*);
+
+    // closes a response begun with begin_response() and injects it
+    void send(JsonWriter&);
+
+    // points into the order, valid while it is
+    OrderFields order_fields(const SimOrder&, const char*) const;
+};
\ No newline at end of file
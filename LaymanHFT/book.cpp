@@ -1,10 +1,82 @@
 #include "book.hpp"
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 // explicit instantiations
 template class BookSide<std::less<double> >;
 template class BookSide<std::greater<double> >;
+template class LadderSide<std::less<double> >;
+template class LadderSide<std::greater<double> >;
+template class BasicBook<Asks, Bids>;
+template class BasicBook<LadderAsks, LadderBids>;
+
+
+BookAction book_action(const char* action)
+{
+	switch (action[0])
+	{
+	case 'n':
+		return BookAction::New;
+	case 'c':
+		return BookAction::Change;
+	case 'd':
+		return BookAction::Delete;
+	default:
+		throw std::runtime_error("Invalid change type");
+	}
+}
+
+const char* book_action_name(BookAction action)
+{
+	switch (action)
+	{
+	case BookAction::New:
+		return "new";
+	case BookAction::Change:
+		return "change";
+	default:
+		return "delete";
+	}
+}
+
+static void print_levels(std::ostream& os, const std::vector<BookLevel>& levels)
+{
+	os << '[';
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		const BookLevel& level = levels[i];
+		os << (i ? "," : "") << "[\"" << book_action_name(level.action) << "\","
+			<< level.price << ',' << level.quantity << ']';
+	}
+	os << ']';
+}
+
+std::ostream& operator<<(std::ostream& os, const BookDelta& delta)
+{
+	const std::streamsize precision = os.precision(15);	// prices and quantities in full
+	os << "{\"change_id\":" << delta.change_id;
+	if (!delta.snapshot)
+	{
+		os << ",\"prev_change_id\":" << delta.prev_change_id;
+	}
+	os << ",\"bids\":";
+	print_levels(os, delta.bids);
+	os << ",\"asks\":";
+	print_levels(os, delta.asks);
+	os.precision(precision);
+	return os << '}';
+}
+
+void BookDelta::clear()
+{
+	snapshot = false;
+	prev_change_id = 0;
+	change_id = 0;
+	bids.clear();
+	asks.clear();
+}
 
 
 template<typename Compare>
@@ -26,33 +98,65 @@ void BookSide<Compare>::update(const rapidjson::Value& arr)
 
 	for (auto it = arr.Begin(); it != arr.End(); ++it)
 	{
-		const std::string& action = (*it)[0].GetString();
-		const double& price = (*it)[1].GetDouble();
-		const double& quantity = (*it)[2].GetDouble();
+		this->apply(
+			book_action((*it)[0].GetString()),
+			(*it)[1].GetDouble(),
+			(*it)[2].GetDouble());
+	}
+}
 
-		if (action == "new")
-		{
-			_data->insert({ price, quantity });
-		}
-		else if (action == "change")
-		{
-			auto it = _data->find(price);
-			assert(it != _data->end());
-			it->second = quantity;
-		}
-		else if (action == "delete")
-		{
-			auto it = _data->find(price);
-			assert(it != _data->end());
-			_data->erase(it);
-		}
-		else
-		{
-			throw std::runtime_error("Invalid change type");
-		}
+template<typename Compare>
+void BookSide<Compare>::update(const std::vector<BookLevel>& levels)
+{
+	for (const auto& level : levels)
+	{
+		this->apply(level.action, level.price, level.quantity);
+	}
+}
+
+template<typename Compare>
+void BookSide<Compare>::apply(BookAction action, double price, double quantity)
+{
+	switch (action)
+	{
+	case BookAction::New:
+		_data->insert({ price, quantity });
+		break;
+	case BookAction::Change:
+	{
+		auto it = _data->find(price);
+		assert(it != _data->end());
+		it->second = quantity;
+		break;
+	}
+	case BookAction::Delete:
+	{
+		auto it = _data->find(price);
+		assert(it != _data->end());
+		_data->erase(it);
+		break;
+	}
+	}
+}
+
+template<typename Compare>
+void BookSide<Compare>::reset(const rapidjson::Value& arr)
+{
+	assert(arr.IsArray());
+
+	this->clear();
+	for (auto it = arr.Begin(); it != arr.End(); ++it)
+	{
+		_data->insert({ (*it)[0].GetDouble(), (*it)[1].GetDouble() });
 	}
 }
 
+template<typename Compare>
+void BookSide<Compare>::clear()
+{
+	_data->clear();
+}
+
 template<typename Compare>
 void BookSide<Compare>::print()
 {
@@ -91,6 +195,13 @@ double BookSide<Compare>::price_depth(
 	return price;
 }
 
+template<typename Compare>
+double BookSide<Compare>::quantity(double price) const
+{
+	auto it = _data->find(price);
+	return (it != _data->end()) ? it->second : 0;
+}
+
 template<typename Compare>
 double BookSide<Compare>::price_depth(double quantity)
 {
@@ -111,26 +222,467 @@ double BookSide<Compare>::price_depth(double quantity)
 	return price;
 }
 
+// Resolves several depths in a single walk from the top of book.
+template<typename Compare>
+void BookSide<Compare>::price_depth(
+	const double* quantities,
+	double* prices,
+	size_t n,
+	double order_price,
+	double order_quantity)
+{
+	double cum_qty = 0;
+	size_t j = 0;
+
+	for (auto it = _data->begin(); it != _data->end() && j < n; ++it)
+	{
+		cum_qty += it->second;
+		if (order_price == it->first)
+		{
+			cum_qty -= order_quantity;
+		}
+
+		while (j < n && cum_qty > quantities[j])
+		{
+			assert(j == 0 || quantities[j - 1] <= quantities[j]);
+			prices[j++] = it->first;
+		}
+	}
+
+	for (; j < n; ++j)
+	{
+		prices[j] = -1;
+	}
+}
+
+
+template<typename Compare>
+LadderSide<Compare>::LadderSide(double tick_size, size_t capacity) :
+	_tick_size(tick_size),
+	_ticks_per_unit(tick_size <= 1 ? std::round(1 / tick_size) : 1 / tick_size),
+	_anchor(0),
+	_best(capacity),
+	_qty(capacity, 0.0),
+	_tree(capacity + 1, 0.0),
+	_tree_step(1)
+{
+	assert(tick_size > 0);
+	assert(capacity > 0);
+
+	while (2 * _tree_step <= capacity)
+	{
+		_tree_step *= 2;
+	}
+}
 
-Book::Book() : _prev_change_id(0)
+// Keys grow away from the top of book on both sides, so the best level
+// always has the lowest key.
+template<typename Compare>
+long LadderSide<Compare>::key(double price) const
 {
+	const long tick = std::lround(price * _ticks_per_unit);
+	return Compare()(0., 1.) ? tick : -tick;
+}
 
+template<typename Compare>
+double LadderSide<Compare>::price(long key) const
+{
+	const double tick = static_cast<double>(Compare()(0., 1.) ? key : -key);
+	// dividing by an integer number of ticks per unit gives the same double
+	// as the decimal price sent by the exchange (e.g. 0.05 tick sizes)
+	return _tick_size <= 1 ? tick / _ticks_per_unit : tick * _tick_size;
 }
 
+template<typename Compare>
+void LadderSide<Compare>::set(long k, double quantity)
+{
+	const size_t capacity = _qty.size();
+	const long headroom = static_cast<long>(capacity / 4);
+
+	if (_best == capacity && _overflow.empty())
+	{
+		// empty book, nothing to move
+		_anchor = k - headroom;
+	}
+	else if (k < _anchor)
+	{
+		recenter(k - headroom);
+	}
+
+	const size_t idx = static_cast<size_t>(k - _anchor);
+	if (idx < capacity)
+	{
+		this->add(idx, quantity - _qty[idx]);
+		_qty[idx] = quantity;
+		if (quantity > 0)
+		{
+			_best = std::min(_best, idx);
+		}
+		else if (idx == _best)
+		{
+			while (_best < capacity && _qty[_best] == 0)
+			{
+				++_best;
+			}
+		}
+	}
+	else if (quantity > 0)
+	{
+		_overflow[k] = quantity;
+	}
+	else
+	{
+		_overflow.erase(k);
+	}
+
+	// the top of book drifted away from the start of the window
+	if (_best == capacity && !_overflow.empty())
+	{
+		recenter(_overflow.begin()->first - headroom);
+	}
+	else if (_best != capacity && _best > capacity / 2)
+	{
+		recenter(_anchor + static_cast<long>(_best) - headroom);
+	}
+}
 
-void Book::update(const rapidjson::Value& data)
+template<typename Compare>
+void LadderSide<Compare>::recenter(long anchor)
 {
-	long change_id = data["change_id"].GetInt64();
-	if (data.HasMember("prev_change_id"))
+	const long capacity = static_cast<long>(_qty.size());
+	const long shift = anchor - _anchor;
+
+	// levels leaving the window go to the overflow map
+	for (long i = static_cast<long>(_best); i < capacity; ++i)
+	{
+		if (_qty[i] > 0 && (i - shift < 0 || i - shift >= capacity))
+		{
+			_overflow.emplace(_anchor + i, _qty[i]);
+		}
+	}
+
+	if (std::abs(shift) >= capacity)
+	{
+		std::fill(_qty.begin(), _qty.end(), 0.0);
+	}
+	else if (shift > 0)
+	{
+		std::copy(_qty.begin() + shift, _qty.end(), _qty.begin());
+		std::fill(_qty.end() - shift, _qty.end(), 0.0);
+	}
+	else if (shift < 0)
+	{
+		std::copy_backward(_qty.begin(), _qty.end() + shift, _qty.end());
+		std::fill(_qty.begin(), _qty.begin() - shift, 0.0);
+	}
+	_anchor = anchor;
+
+	// levels entering the window come back from the overflow map
+	auto it = _overflow.lower_bound(_anchor);
+	auto end = _overflow.lower_bound(_anchor + capacity);
+	while (it != end)
+	{
+		_qty[it->first - _anchor] = it->second;
+		it = _overflow.erase(it);
+	}
+	assert(_overflow.empty() || _overflow.begin()->first >= _anchor + capacity);
+
+	// rebuild the Fenwick tree in linear time
+	for (long i = 1; i <= capacity; ++i)
 	{
-		long prev_change_id = data["prev_change_id"].GetInt64();
-		if (_prev_change_id != prev_change_id)
+		_tree[i] = _qty[i - 1];
+	}
+	for (long i = 1; i <= capacity; ++i)
+	{
+		const long parent = i + (i & -i);
+		if (parent <= capacity)
 		{
-			throw std::runtime_error("Invalid change_id sequence");
+			_tree[parent] += _tree[i];
 		}
 	}
-	_prev_change_id = change_id;
 
-	this->bids.update(data["bids"]);
-	this->asks.update(data["asks"]);
+	_best = 0;
+	while (_best < _qty.size() && _qty[_best] == 0)
+	{
+		++_best;
+	}
 }
+
+template<typename Compare>
+void LadderSide<Compare>::update(const rapidjson::Value& arr)
+{
+	assert(arr.IsArray());
+
+	for (auto it = arr.Begin(); it != arr.End(); ++it)
+	{
+		this->apply(
+			book_action((*it)[0].GetString()),
+			(*it)[1].GetDouble(),
+			(*it)[2].GetDouble());
+	}
+}
+
+template<typename Compare>
+void LadderSide<Compare>::update(const std::vector<BookLevel>& levels)
+{
+	for (const auto& level : levels)
+	{
+		this->apply(level.action, level.price, level.quantity);
+	}
+}
+
+template<typename Compare>
+void LadderSide<Compare>::apply(BookAction action, double price, double quantity)
+{
+	this->set(key(price), action == BookAction::Delete ? 0 : quantity);
+}
+
+template<typename Compare>
+void LadderSide<Compare>::reset(const rapidjson::Value& arr)
+{
+	assert(arr.IsArray());
+
+	this->clear();
+	for (auto it = arr.Begin(); it != arr.End(); ++it)
+	{
+		this->set(key((*it)[0].GetDouble()), (*it)[1].GetDouble());
+	}
+}
+
+template<typename Compare>
+void LadderSide<Compare>::clear()
+{
+	std::fill(_qty.begin(), _qty.end(), 0.0);
+	std::fill(_tree.begin(), _tree.end(), 0.0);
+	_overflow.clear();
+	_best = _qty.size();
+}
+
+template<typename Compare>
+void LadderSide<Compare>::print()
+{
+	std::cout << std::endl;
+	std::cout << "Price\tQuantity" << std::endl;
+	for (size_t i = _best; i < _qty.size(); ++i)
+	{
+		if (_qty[i] > 0)
+		{
+			std::cout << price(_anchor + static_cast<long>(i)) << "\t" << _qty[i] << std::endl;
+		}
+	}
+	for (const auto& it : _overflow)
+	{
+		std::cout << price(it.first) << "\t" << it.second << std::endl;
+	}
+}
+
+template<typename Compare>
+void LadderSide<Compare>::add(size_t idx, double delta)
+{
+	for (size_t i = idx + 1; i < _tree.size(); i += i & (~i + 1))
+	{
+		_tree[i] += delta;
+	}
+}
+
+template<typename Compare>
+double LadderSide<Compare>::window_total() const
+{
+	double total = 0;
+	for (size_t i = _qty.size(); i > 0; i -= i & (~i + 1))
+	{
+		total += _tree[i];
+	}
+	return total;
+}
+
+// First slot whose cumulative quantity exceeds the given quantity, or the
+// capacity if the whole window does not.
+template<typename Compare>
+size_t LadderSide<Compare>::lower_slot(double quantity) const
+{
+	size_t pos = 0;
+	for (size_t step = _tree_step; step > 0; step >>= 1)
+	{
+		if (pos + step < _tree.size() && _tree[pos + step] <= quantity)
+		{
+			pos += step;
+			quantity -= _tree[pos];
+		}
+	}
+	return pos;
+}
+
+template<typename Compare>
+double LadderSide<Compare>::price_depth(
+	double quantity,
+	double order_price,
+	double order_quantity)
+{
+	const size_t capacity = _qty.size();
+	const long order_key = key(order_price);
+	size_t order_idx = static_cast<size_t>(order_key - _anchor);
+	if (order_key < _anchor || order_idx >= capacity || _qty[order_idx] == 0)
+	{
+		order_idx = capacity;
+	}
+
+	// the own order is only discounted from the slots after it
+	size_t idx = this->lower_slot(quantity);
+	if (idx >= order_idx)
+	{
+		idx = std::max(this->lower_slot(quantity + order_quantity), order_idx);
+	}
+
+	if (idx < capacity)
+	{
+		return price(_anchor + static_cast<long>(idx));
+	}
+
+	double cum_qty = this->window_total();
+	if (order_idx < capacity)
+	{
+		cum_qty -= order_quantity;
+	}
+
+	for (const auto& it : _overflow)
+	{
+		cum_qty += it.second;
+		if (it.first == order_key)
+		{
+			cum_qty -= order_quantity;
+		}
+
+		if (cum_qty > quantity)
+		{
+			return price(it.first);
+		}
+	}
+
+	return -1;
+}
+
+template<typename Compare>
+double LadderSide<Compare>::price_depth(double quantity)
+{
+	const size_t idx = this->lower_slot(quantity);
+	if (idx < _qty.size())
+	{
+		return price(_anchor + static_cast<long>(idx));
+	}
+
+	double cum_qty = this->window_total();
+	for (const auto& it : _overflow)
+	{
+		cum_qty += it.second;
+
+		if (cum_qty > quantity)
+		{
+			return price(it.first);
+		}
+	}
+
+	return -1;
+}
+
+// Each depth is a logarithmic search on the ladder, no walk is needed.
+template<typename Compare>
+void LadderSide<Compare>::price_depth(
+	const double* quantities,
+	double* prices,
+	size_t n,
+	double order_price,
+	double order_quantity)
+{
+	for (size_t j = 0; j < n; ++j)
+	{
+		prices[j] = this->price_depth(quantities[j], order_price, order_quantity);
+	}
+}
+
+
+template<typename AsksT, typename BidsT>
+void BasicBook<AsksT, BidsT>::update(const rapidjson::Value& data)
+{
+	_decoded.snapshot = !data.HasMember("prev_change_id");
+	_decoded.prev_change_id = _decoded.snapshot ? 0 : data["prev_change_id"].GetInt64();
+	_decoded.change_id = data["change_id"].GetInt64();
+
+	const std::pair<const rapidjson::Value*, std::vector<BookLevel>*> sides[] = {
+		{ &data["bids"], &_decoded.bids },
+		{ &data["asks"], &_decoded.asks }
+	};
+	for (const auto& side : sides)
+	{
+		side.second->clear();
+		for (auto it = side.first->Begin(); it != side.first->End(); ++it)
+		{
+			side.second->push_back({
+				book_action((*it)[0].GetString()),
+				(*it)[1].GetDouble(),
+				(*it)[2].GetDouble()
+			});
+		}
+	}
+
+	this->update(_decoded);
+}
+
+template<typename AsksT, typename BidsT>
+void BasicBook<AsksT, BidsT>::update(const BookDelta& delta)
+{
+	if (delta.snapshot)
+	{
+		// full snapshot (first notification after subscribing)
+		this->bids.clear();
+		this->asks.clear();
+		_pending.clear();
+		_stale = false;
+	}
+	else if (_stale || (_prev_change_id != delta.prev_change_id))
+	{
+		_stale = true;
+		if (_pending.size() >= kMaxPending)
+		{
+			_pending.clear();
+		}
+		_pending.push_back(delta);
+		return;
+	}
+
+	this->apply(delta);
+}
+
+template<typename AsksT, typename BidsT>
+void BasicBook<AsksT, BidsT>::reset(const rapidjson::Value& snapshot)
+{
+	this->bids.reset(snapshot["bids"]);
+	this->asks.reset(snapshot["asks"]);
+	_prev_change_id = snapshot["change_id"].GetInt64();
+	_stale = false;
+
+	while (!_pending.empty())
+	{
+		const auto& delta = _pending.front();
+		if (delta.change_id > _prev_change_id)
+		{
+			if (delta.prev_change_id != _prev_change_id)
+			{
+				// the snapshot does not reach the buffered notifications
+				_stale = true;
+				return;
+			}
+			this->apply(delta);
+		}
+		_pending.pop_front();
+	}
+}
+
+template<typename AsksT, typename BidsT>
+void BasicBook<AsksT, BidsT>::apply(const BookDelta& delta)
+{
+	_prev_change_id = delta.change_id;
+
+	this->bids.update(delta.bids);
+	this->asks.update(delta.asks);
+}
\ No newline at end of file
@@ -1,20 +1,49 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
+#include <deque>
 #include <memory>
 #include <string>
+#include <vector>
 #include <functional>
+#include <iosfwd>
 #include <rapidjson/document.h>
 
 
-struct Order
+enum class BookAction : char
 {
-	double price = 0;
-	double quantity = 0;
-	std::string id = "";
-	bool wait = false;
+	New,
+	Change,
+	Delete
 };
 
+BookAction book_action(const char*);	// "new", "change" or "delete"
+const char* book_action_name(BookAction);
+
+
+struct BookLevel
+{
+	BookAction action;
+	double price;
+	double quantity;
+};
+
+
+// Decoded book notification, with the vectors reused between messages
+struct BookDelta
+{
+	bool snapshot = false;		// no prev_change_id, replaces the book
+	int64_t prev_change_id = 0;
+	int64_t change_id = 0;
+	std::vector<BookLevel> bids;
+	std::vector<BookLevel> asks;
+
+	void clear();
+};
+
+// as the data of a book notification
+std::ostream& operator<<(std::ostream&, const BookDelta&);
 
 
 template<typename Compare>
@@ -25,30 +54,136 @@ public:
 	~BookSide();
 
 	void update(const rapidjson::Value&);
+	void update(const std::vector<BookLevel>&);
+	void reset(const rapidjson::Value&);
+	void clear();
 	void print();
 
 	double price_depth(double, double, double);
 	double price_depth(double);
+	void price_depth(
+		const double*,	// quantities, sorted in increasing order
+		double*,		// prices (output)
+		size_t,			// number of quantities
+		double,			// order price
+		double			// order quantity
+	);
+
+	// quantity resting at the price, 0 if there is no level
+	double quantity(double) const;
+
+	// levels from the top of book, price to quantity
+	const std::map<double, double, Compare>& levels() const { return *_data; }
 
 private:
 	std::map<double, double, Compare>* _data;
+
+	void apply(BookAction, double, double);
+};
+
+
+// Book side stored as a flat array of quantities indexed by the tick offset
+// from a moving anchor. Slot 0 is the best price the window can hold, and
+// the window recenters when the top of book drifts out of it. Levels that
+// fall outside the window are kept in an overflow map.
+// A Fenwick tree over the window keeps the cumulative quantities, so depth
+// queries are a logarithmic search instead of a walk from the top of book.
+template<typename Compare>
+class LadderSide
+{
+public:
+	LadderSide(
+		double,			// tick size
+		size_t = 4096	// window capacity (in ticks)
+	);
+
+	void update(const rapidjson::Value&);
+	void update(const std::vector<BookLevel>&);
+	void reset(const rapidjson::Value&);
+	void clear();
+	void print();
+
+	double price_depth(double, double, double);
+	double price_depth(double);
+	void price_depth(
+		const double*,	// quantities, sorted in increasing order
+		double*,		// prices (output)
+		size_t,			// number of quantities
+		double,			// order price
+		double			// order quantity
+	);
+
+private:
+	const double _tick_size;
+	const double _ticks_per_unit;
+	long _anchor;						// key of slot 0
+	size_t _best;						// first non-empty slot (or capacity)
+	std::vector<double> _qty;			// quantity per slot, 0 if empty
+	std::vector<double> _tree;			// Fenwick tree over _qty (1-based)
+	size_t _tree_step;					// highest power of 2 <= capacity
+	std::map<long, double> _overflow;	// levels outside the window, by key
+
+	long key(double) const;
+	double price(long) const;
+	void apply(BookAction, double, double);
+	void set(long, double);
+	void recenter(long);
+
+	void add(size_t, double);
+	double window_total() const;
+	size_t lower_slot(double) const;
 };
 
 
 using Asks = BookSide<std::less<double>>;
 using Bids = BookSide<std::greater<double>>;
 
+using LadderAsks = LadderSide<std::less<double>>;
+using LadderBids = LadderSide<std::greater<double>>;
 
-class Book
+
+template<typename AsksT, typename BidsT>
+class BasicBook
 {
 public:
-	Asks asks;
-	Bids bids;
-
-	Book();
+	AsksT asks;
+	BidsT bids;
+
+	// forwards the arguments to both sides (e.g. the tick size of a ladder)
+	template<typename... Args>
+	explicit BasicBook(const Args&... args) :
+		asks(args...),
+		bids(args...),
+		_prev_change_id(0),
+		_stale(false)
+	{
+	}
+
+	// Applies a book notification. On a change_id gap the book is marked
+	// stale and the following notifications are buffered until a snapshot
+	// is passed to reset(). Past kMaxPending the buffer is dropped and
+	// starts over, so that only a snapshot taken since can catch up.
+	static const size_t kMaxPending = 4096;
 
 	void update(const rapidjson::Value&);
+	void update(const BookDelta&);
+
+	// Replaces the book with a public/get_order_book snapshot and replays the
+	// buffered notifications on top of it. The book stays stale if they do
+	// not chain with the snapshot change_id.
+	void reset(const rapidjson::Value&);
+
+	bool stale() const { return _stale; }
 
 private:
-	long _prev_change_id;
-};
\ No newline at end of file
+	int64_t _prev_change_id;
+	bool _stale;
+	std::deque<BookDelta> _pending;
+	BookDelta _decoded;		// scratch for notifications given as DOM
+
+	void apply(const BookDelta&);
+};
+
+
+using Book = BasicBook<Asks, Bids>;
+using LadderBook = BasicBook<LadderAsks, LadderBids>;
\ No newline at end of file
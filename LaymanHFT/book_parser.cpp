@@ -0,0 +1,309 @@
+#include "book_parser.hpp"
+#include <cstring>
+
+
+namespace
+{
+    bool equals(const char* str, rapidjson::SizeType length, const char* literal, size_t literal_length)
+    {
+        return (length == literal_length) && (std::memcmp(str, literal, length) == 0);
+    }
+}
+
+#define EQUALS(str, length, literal) equals(str, length, literal, sizeof(literal) - 1)
+
+
+BookParser::BookParser() :
+    _channels(nullptr),
+    _channel(nullptr),
+    _delta(nullptr),
+    _levels(nullptr),
+    _field(Field::Other),
+    _depth(0),
+    _skip(0),
+    _level_field(0),
+    _is_book(false),
+    _has_data(false)
+{
+}
+
+bool BookParser::parse(const char* msg, const NameTable& channels, int& channel, BookDelta& delta)
+{
+    _channels = &channels;
+    _channel = &channel;
+    _delta = &delta;
+    _levels = nullptr;
+    _field = Field::Other;
+    _depth = 0;
+    _skip = 0;
+    _level_field = 0;
+    _is_book = false;
+    _has_data = false;
+
+    delta.clear();
+    delta.snapshot = true;  // until a prev_change_id shows up
+
+    rapidjson::StringStream ss(msg);
+    _reader.Parse<rapidjson::kParseDefaultFlags>(ss, *this);
+
+    return !_reader.HasParseError() && _is_book && _has_data;
+}
+
+bool BookParser::StartObject()
+{
+    if (_skip > 0)
+    {
+        ++_skip;
+    }
+    else if ((_depth == 0) ||
+             (_depth == 1 && _field == Field::Params) ||
+             (_depth == 2 && _field == Field::Data))
+    {
+        _has_data = _has_data || (_depth == 2);
+        ++_depth;
+    }
+    else if (this->ignored())
+    {
+        ++_skip;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool BookParser::EndObject(rapidjson::SizeType)
+{
+    if (_skip > 0)
+    {
+        --_skip;
+    }
+    else
+    {
+        --_depth;
+        _field = Field::Other;
+    }
+    return true;
+}
+
+bool BookParser::StartArray()
+{
+    if (_skip > 0)
+    {
+        ++_skip;
+    }
+    else if ((_depth == 3) && (_field == Field::Bids || _field == Field::Asks))
+    {
+        _levels = (_field == Field::Bids) ? &_delta->bids : &_delta->asks;
+        ++_depth;
+    }
+    else if ((_depth == 4) && (_levels != nullptr))
+    {
+        // one [action, price, quantity] level
+        _levels->push_back({ BookAction::New, 0, 0 });
+        _level_field = 0;
+        ++_depth;
+    }
+    else if (this->ignored())
+    {
+        ++_skip;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Objects and arrays under keys we do not care about are skipped
+bool BookParser::ignored() const
+{
+    return (_depth > 0) && (_depth < 4) && (_field == Field::Other);
+}
+
+bool BookParser::EndArray(rapidjson::SizeType)
+{
+    if (_skip > 0)
+    {
+        --_skip;
+        return true;
+    }
+
+    if (_depth == 5)
+    {
+        if (_level_field != 3)
+        {
+            return false;
+        }
+    }
+    else if (_depth == 4)
+    {
+        _levels = nullptr;
+        _field = Field::Other;
+    }
+
+    --_depth;
+    return true;
+}
+
+bool BookParser::Key(const char* str, rapidjson::SizeType length, bool)
+{
+    if (_skip > 0)
+    {
+        return true;
+    }
+
+    _field = Field::Other;
+
+    switch (_depth)
+    {
+    case 1:     // envelope
+        if (EQUALS(str, length, "id"))
+        {
+            // responses are never book notifications
+            return false;
+        }
+        else if (EQUALS(str, length, "method"))
+        {
+            _field = Field::Method;
+        }
+        else if (EQUALS(str, length, "params"))
+        {
+            _field = Field::Params;
+        }
+        break;
+    case 2:     // params
+        if (EQUALS(str, length, "channel"))
+        {
+            _field = Field::Channel;
+        }
+        else if (EQUALS(str, length, "data"))
+        {
+            _field = Field::Data;
+        }
+        break;
+    case 3:     // data
+        if (EQUALS(str, length, "bids"))
+        {
+            _field = Field::Bids;
+        }
+        else if (EQUALS(str, length, "asks"))
+        {
+            _field = Field::Asks;
+        }
+        else if (EQUALS(str, length, "change_id"))
+        {
+            _field = Field::ChangeId;
+        }
+        else if (EQUALS(str, length, "prev_change_id"))
+        {
+            _field = Field::PrevChangeId;
+        }
+        break;
+    }
+    return true;
+}
+
+bool BookParser::String(const char* str, rapidjson::SizeType length, bool)
+{
+    if (_skip > 0)
+    {
+        return true;
+    }
+
+    if (_depth == 5)
+    {
+        if ((_level_field != 0) || (length == 0))
+        {
+            return false;
+        }
+
+        BookAction& action = _levels->back().action;
+        switch (str[0])
+        {
+        case 'n':
+            action = BookAction::New;
+            break;
+        case 'c':
+            action = BookAction::Change;
+            break;
+        case 'd':
+            action = BookAction::Delete;
+            break;
+        default:
+            return false;
+        }
+        ++_level_field;
+        return true;
+    }
+
+    if (_field == Field::Method)
+    {
+        // anything else than a subscription goes through the DOM
+        return EQUALS(str, length, "subscription");
+    }
+
+    if (_field == Field::Channel)
+    {
+        if ((length < 5) || (std::memcmp(str, "book.", 5) != 0))
+        {
+            return false;
+        }
+        *_channel = _channels->find(str, length);
+        _is_book = (*_channel != NameTable::kNone);
+        return _is_book;
+    }
+    return true;
+}
+
+bool BookParser::number(double value)
+{
+    if (_skip > 0)
+    {
+        return true;
+    }
+
+    if (_depth == 5)
+    {
+        BookLevel& level = _levels->back();
+        switch (_level_field++)
+        {
+        case 1:
+            level.price = value;
+            return true;
+        case 2:
+            level.quantity = value;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool BookParser::Int64(int64_t value)
+{
+    if ((_skip == 0) && (_depth == 3))
+    {
+        if (_field == Field::ChangeId)
+        {
+            _delta->change_id = static_cast<int64_t>(value);
+        }
+        else if (_field == Field::PrevChangeId)
+        {
+            _delta->prev_change_id = static_cast<int64_t>(value);
+            _delta->snapshot = false;
+        }
+        return true;
+    }
+    return this->number(static_cast<double>(value));
+}
+
+bool BookParser::Null()                 { return (_skip > 0) || (_depth != 5); }
+bool BookParser::Bool(bool)             { return (_skip > 0) || (_depth != 5); }
+bool BookParser::Int(int value)         { return this->Int64(value); }
+bool BookParser::Uint(unsigned value)   { return this->Int64(value); }
+bool BookParser::Uint64(uint64_t value) { return this->Int64(static_cast<int64_t>(value)); }
+bool BookParser::Double(double value)   { return this->number(value); }
@@ -0,0 +1,74 @@
+#pragma once
+#include "book.hpp"
+#include "name_table.hpp"
+
+#include <rapidjson/reader.h>
+
+#include <string>
+
+
+// SAX handler decoding "book.*" subscription notifications straight into a
+// BookDelta, without building a DOM. Parsing stops as soon as the message
+// turns out to be anything else, so that the caller can fall back to the
+// DOM path.
+class BookParser : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, BookParser>
+{
+public:
+    BookParser();
+
+    // Returns false (leaving the message untouched) if it is not a book
+    // notification with [action, price, quantity] levels on one of the
+    // registered channels.
+    bool parse(
+        const char*,            // null-terminated message
+        const NameTable&,       // registered channels
+        int&,                   // channel handle (output)
+        BookDelta&              // decoded notification (output)
+    );
+
+    // SAX events
+    bool Null();
+    bool Bool(bool);
+    bool Int(int);
+    bool Uint(unsigned);
+    bool Int64(int64_t);
+    bool Uint64(uint64_t);
+    bool Double(double);
+    bool String(const char*, rapidjson::SizeType, bool);
+    bool StartObject();
+    bool Key(const char*, rapidjson::SizeType, bool);
+    bool EndObject(rapidjson::SizeType);
+    bool StartArray();
+    bool EndArray(rapidjson::SizeType);
+
+private:
+    enum class Field
+    {
+        Other,
+        Method,
+        Params,
+        Channel,
+        Data,
+        PrevChangeId,
+        ChangeId,
+        Bids,
+        Asks
+    };
+
+    rapidjson::Reader _reader;
+
+    // parsing state
+    const NameTable* _channels;
+    int* _channel;
+    BookDelta* _delta;
+    std::vector<BookLevel>* _levels;   // side being read, if any
+    Field _field;                       // last key seen
+    size_t _depth;                      // nesting of the current value
+    size_t _skip;                       // nesting inside an ignored value
+    size_t _level_field;                // index inside a level array
+    bool _is_book;                      // method and channel both matched
+    bool _has_data;
+
+    bool number(double);
+    bool ignored() const;
+};
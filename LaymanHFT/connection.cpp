@@ -1,6 +1,12 @@
 #include "connection.hpp"
 #include <boost/algorithm/string.hpp> // for case-insensitive string comparison
+#include <iostream>
 #include <regex>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
 
 
 URI parseURI(const std::string& url) {
@@ -25,8 +31,15 @@ URI parseURI(const std::string& url) {
 }
 
 // Sends a WebSocket message and prints the response
-WSSession::WSSession(const URI& uri)
+WSSession::WSSession(const URI& uri, net::io_context& ioc) :
+    _ioc(ioc),
+    _async(false),
+    _writing(false),
+    _wake(false)
 {
+    // Large enough for book snapshots, so that reads do not reallocate
+    _buffer.reserve(1 << 20);
+
     // The SSL context is required, and holds certificates
     ssl::context ctx{ ssl::context::tlsv12_client };
 
@@ -64,8 +77,12 @@ WSSession::WSSession(const URI& uri)
 
 WSSession::~WSSession()
 {
-    // Close the WebSocket connection
-    _ws->close(websocket::close_code::normal);
+    // Close the WebSocket connection, unless it already dropped
+    if (_ws->is_open())
+    {
+        beast::error_code ec;
+        _ws->close(websocket::close_code::normal, ec);
+    }
 
     // deletes the tcp_websocket before than ioc
     _ws.reset();
@@ -73,7 +90,34 @@ WSSession::~WSSession()
 
 void WSSession::send(std::string msg)
 {
-    _ws->write(net::buffer(msg));
+    if (!_async)
+    {
+        _ws->write(net::buffer(msg));
+    }
+    else
+    {
+        std::string* slot = _outbound.claim();
+        if (slot == nullptr)
+        {
+            throw std::runtime_error("Outbound queue full");
+        }
+        slot->swap(msg);
+        _outbound.publish();
+
+        // a write chain in progress picks it up by itself; otherwise the
+        // strand is woken, inline when called from one of its handlers
+        if (!_wake.exchange(true))
+        {
+            net::dispatch(_ws->get_executor(), [this]()
+                {
+                    _wake.exchange(false);
+                    if (!_writing)
+                    {
+                        this->do_write();
+                    }
+                });
+        }
+    }
 }
 
 std::string WSSession::recv()
@@ -83,8 +127,93 @@ std::string WSSession::recv()
     return beast::buffers_to_string(buffer.data());
 }
 
+char* WSSession::recv_inplace()
+{
+    _buffer.clear();
+    _ws->read(_buffer);
+    _received = timestamp_now();
+
+    // null terminator right after the message, outside the readable bytes
+    auto tail = _buffer.prepare(1);
+    *static_cast<char*>(tail.data()) = '\0';
+    return static_cast<char*>(_buffer.data().data());
+}
+
 bool WSSession::is_open()
 {
     return _ws->is_open();
 }
 
+void WSSession::start_async(std::function<void(char*)> on_read)
+{
+    _async = true;
+    _on_read = std::move(on_read);
+    net::post(_ws->get_executor(), [this]() { this->do_read(); });
+}
+
+void WSSession::set_low_latency(int busy_poll_us, std::ostream& log)
+{
+    auto& socket = get_lowest_layer(*_ws).socket();
+    socket.set_option(tcp::no_delay(true));
+    socket.non_blocking(true);
+
+    if (busy_poll_us > 0)
+    {
+#ifdef SO_BUSY_POLL
+        if (setsockopt(socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL,
+            &busy_poll_us, sizeof(busy_poll_us)) != 0)
+        {
+            log << "SO_BUSY_POLL refused (needs CAP_NET_ADMIN above net.core.busy_read)" << std::endl;
+        }
+#else
+        log << "SO_BUSY_POLL is not supported on this platform" << std::endl;
+#endif
+    }
+}
+
+void WSSession::do_read()
+{
+    _buffer.clear();
+    _ws->async_read(_buffer, [this](beast::error_code ec, std::size_t)
+        {
+            if (ec)
+            {
+                // closed or dropped, whoever runs the (possibly shared)
+                // io_context gets control back to tear down or reconnect
+                _ioc.stop();
+                return;
+            }
+
+            _received = timestamp_now();
+            auto tail = _buffer.prepare(1);
+            *static_cast<char*>(tail.data()) = '\0';
+            _on_read(static_cast<char*>(_buffer.data().data()));
+
+            this->do_read();
+        });
+}
+
+// Messages queued while a write is in flight go out back to back as soon as
+// it completes, without waiting for the reader. A message stays in its slot
+// until its write completes.
+void WSSession::do_write()
+{
+    std::string* msg = _outbound.front();
+    if (msg == nullptr)
+    {
+        _writing = false;
+        return;
+    }
+
+    _writing = true;
+    _ws->async_write(net::buffer(*msg), [this](beast::error_code ec, std::size_t)
+        {
+            _outbound.pop();
+            if (ec)
+            {
+                _writing = false;
+                return;
+            }
+            this->do_write();
+        });
+}
\ No newline at end of file
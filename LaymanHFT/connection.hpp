@@ -1,5 +1,8 @@
 #pragma once
 
+#include "spsc_ring.hpp"
+#include "timestamp.hpp"
+
 #include <boost/beast/core.hpp>
 #include <boost/beast/ssl.hpp>
 #include <boost/beast/websocket.hpp>
@@ -8,6 +11,9 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/strand.hpp>
 #include <boost/asio/ssl/stream.hpp>
+#include <atomic>
+#include <functional>
+#include <ostream>
 #include <string>
 
 namespace beast = boost::beast;         // from <boost/beast.hpp>
@@ -34,14 +40,49 @@ URI parseURI(const std::string&);
 class WSSession : public std::enable_shared_from_this<WSSession>
 {
     std::shared_ptr<tcp_websocket> _ws;
-    net::io_context _ioc;
+    net::io_context& _ioc;          // possibly shared with other sessions
+    beast::flat_buffer _buffer;     // reused by recv_inplace
+    Timestamp _received;            // of the last message read
+
+    // Asynchronous mode. Sent messages are handed to the websocket strand
+    // through a lock-free ring, from one sending thread at a time; the strand
+    // is only woken when it may have gone idle.
+    static const size_t kOutboundCapacity = 1024;
+    bool _async;
+    bool _writing;                      // strand only
+    std::atomic<bool> _wake;            // a flush is posted to the strand
+    std::function<void(char*)> _on_read;
+    SpscRing<std::string, kOutboundCapacity> _outbound;
+
+    void do_read();
+    void do_write();
 
 public:
-    // Resolver and socket require an io_context
-    explicit WSSession(const URI& uri);
+    // Resolver and socket require an io_context, which outlives the session
+    WSSession(const URI& uri, net::io_context& ioc);
     ~WSSession();
 
     void send(std::string msg);
     std::string recv();
+
+    // Reads the next message into the session buffer and returns it as a
+    // null-terminated string which can be parsed (and modified) in place.
+    // It stays valid until the next read.
+    char* recv_inplace();
     bool is_open();
+
+    // when the last message read was complete
+    const Timestamp& received() const { return _received; }
+
+    // Switches to asynchronous mode. Each message read is passed to the
+    // handler (null-terminated, modifiable in place), and send() queues the
+    // message behind the write in flight instead of blocking; it throws if
+    // kOutboundCapacity messages are already waiting. Reads and
+    // writes make progress as the io_context is run.
+    void start_async(std::function<void(char*)>);
+
+    // Disables Nagle, makes the socket non-blocking and, where supported,
+    // asks the kernel to busy-poll the device queue for busy_poll_us on reads.
+    // Says on the log when busy polling is not available.
+    void set_low_latency(int busy_poll_us, std::ostream& log);
 };
\ No newline at end of file
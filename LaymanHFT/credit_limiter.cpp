@@ -0,0 +1,33 @@
+#include "credit_limiter.hpp"
+#include <algorithm>
+
+
+CreditLimiter::CreditLimiter(double capacity, double refill, double cost) :
+    _capacity(capacity),
+    _refill(refill),
+    _cost(cost),
+    _credits(capacity),
+    _updated()      // starts full from the first time given, live or replayed
+{
+}
+
+double CreditLimiter::available(std::chrono::steady_clock::time_point now)
+{
+    if (now > _updated)
+    {
+        const double elapsed = std::chrono::duration<double>(now - _updated).count();
+        _credits = std::min(_capacity, _credits + elapsed * _refill);
+        _updated = now;
+    }
+    return _credits;
+}
+
+bool CreditLimiter::take(std::chrono::steady_clock::time_point now)
+{
+    if (this->available(now) < _cost)
+    {
+        return false;
+    }
+    _credits -= _cost;
+    return true;
+}
\ No newline at end of file
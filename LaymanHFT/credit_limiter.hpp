@@ -0,0 +1,29 @@
+#pragma once
+
+#include <chrono>
+
+
+// Client-side model of the exchange's request credits. Each request costs a
+// fixed amount, and the pool refills at a constant rate up to its capacity.
+// Staying within it avoids the exchange throttling the account.
+class CreditLimiter
+{
+public:
+    CreditLimiter(
+        double,                     // capacity
+        double,                     // refill per second
+        double                      // cost of a request
+    );
+
+    // Takes the credits for one request, false if there are not enough
+    bool take(std::chrono::steady_clock::time_point);
+
+    double available(std::chrono::steady_clock::time_point);
+
+private:
+    double _capacity;
+    double _refill;
+    double _cost;
+    double _credits;
+    std::chrono::steady_clock::time_point _updated;
+};
\ No newline at end of file
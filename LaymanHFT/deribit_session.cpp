@@ -1,6 +1,14 @@
 #include "deribit_session.hpp"
+#include "affinity.hpp"
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+
+std::atomic<bool> DeribitSession::_stop(false);
 
 
 std::ostream& operator<<(std::ostream& os, const rapidjson::Value& d)
@@ -14,30 +22,192 @@ std::ostream& operator<<(std::ostream& os, const rapidjson::Value& d)
 
 
 DeribitSession::DeribitSession(const API_Settings& settings)
-    : _session(settings.uri)
+    : _settings(settings),
+    _quiet_log(nullptr),
+    _log(settings.quiet ? &_quiet_log : &std::cout),
+    _source(nullptr),
+    _arena(new char[kValueArenaSize + kStackArenaSize]),
+    _value_allocator(_arena.get(), kValueArenaSize),
+    _stack_allocator(_arena.get() + kValueArenaSize, kStackArenaSize),
+    _book_deltas(false),
+    _book_delta_channel(NameTable::kNone),
+    _async_io(settings.async_io),
+    _spin(settings.spin),
+    _busy_poll_us(settings.busy_poll_us),
+    _lock_memory(settings.lock_memory),
+    _reconnect(settings.reconnect),
+    _pipeline(settings.pipeline),
+    _io_core(settings.io_core),
+    _strategy_core(settings.strategy_core),
+    _io_done(false),
+    _queued_frames(0),
+    _queue_delay_total(0),
+    _queue_delay_max(0),
+    _credits(settings.credits, settings.credit_refill, settings.order_credits),
+    _held_edits(0)
+{
+    if (settings.replay_recording)
+    {
+        _replay.reset(new Replay(settings.replay_recording, settings.replay_speed, settings.replay_from));
+    }
+    else if (!settings.replay.empty())
+    {
+        _replay.reset(new Replay(settings.replay, settings.replay_speed, settings.replay_from));
+    }
+    this->connect();
+    this->authenticate();
+}
+
+void DeribitSession::connect()
+{
+    if (_replay)
+    {
+        return;
+    }
+
+    _ioc.reset(new net::io_context);
+    _market.reset(new WSSession(_settings.uri, *_ioc));
+    _source = _market.get();
+
+    if (!_settings.client_id.empty() && _settings.order_connection)
+    {
+        _trading.reset(new WSSession(_settings.uri, *_ioc));
+    }
+}
+
+void DeribitSession::authenticate()
 {
-    if (!settings.client_id.empty())
+    if (!_refresh_token.empty())
+    {
+        this->send("public/auth", {
+                {"grant_type", "refresh_token"},
+                {"refresh_token", _refresh_token}
+            });
+    }
+    else if (!_settings.client_id.empty())
     {
         this->send("public/auth", {
                 {"grant_type", "client_credentials"},
-                {"client_id", settings.client_id},
-                {"client_secret", settings.client_secret}
+                {"client_id", _settings.client_id},
+                {"client_secret", _settings.client_secret}
             });
     }
 }
 
-void DeribitSession::send_json(const std::string& method, rapidjson::Document& params)
+void DeribitSession::reconnect()
+{
+    // nothing sent on the old connections will be answered
+    for (Request* request = _requests.oldest(); request != nullptr; request = _requests.oldest())
+    {
+        this->give_up(*request);
+    }
+    _edits.clear();
+    _held_edits = 0;
+
+    // sessions go first, the io_context then drops their pending handlers
+    _trading.reset();
+    _market.reset();
+    _ioc.reset();
+
+    this->connect();
+    this->authenticate();
+
+    std::vector<std::string> channels;
+    for (size_t i = 0; i < _channels.size(); i++)
+    {
+        channels.push_back(_channels.name(static_cast<int>(i)));
+    }
+    if (!channels.empty())
+    {
+        this->subscribe(channels);  // handles are kept
+    }
+
+    this->on_reconnect();
+}
+
+void DeribitSession::enable_book_deltas()
+{
+    _book_deltas = true;
+}
+
+int DeribitSession::channel_handle(const std::string& channel) const
+{
+    return _channels.find(channel);
+}
+
+const std::string& DeribitSession::channel_name(int handle) const
+{
+    return _channels.name(handle);
+}
+
+Request& DeribitSession::new_request(Method method)
+{
+    // the table is wrapping around, give up on the oldest requests
+    while (_requests.full())
+    {
+        this->give_up(*_requests.oldest());
+    }
+
+    Request& request = _requests.add(method);
+    request.sent = this->now();
+    return request;
+}
+
+void DeribitSession::expire_requests()
+{
+    const auto deadline = this->now() - std::chrono::seconds(kRequestTimeoutSeconds);
+
+    for (Request* request = _requests.oldest();
+        (request != nullptr) && (request->sent < deadline);
+        request = _requests.oldest())
+    {
+        this->give_up(*request);
+    }
+}
+
+std::chrono::steady_clock::time_point DeribitSession::now() const
+{
+    if (_replay)
+    {
+        return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(_replay->now().ns));
+    }
+    return std::chrono::steady_clock::now();
+}
+
+void DeribitSession::give_up(Request& request)
+{
+    this->on_timeout(request);
+    this->edit_done(request);
+    _requests.release(request.id);
+}
+
+WSSession& DeribitSession::route(const Request& request)
+{
+    if (!_trading)
+    {
+        return *_market;
+    }
+
+    if (request.method == Method::PublicAuth || std::strncmp(request.name(), "private/", 8) == 0)
+    {
+        return *_trading;
+    }
+    if (request.method == Method::PublicTest)
+    {
+        return *_source;    // heartbeats are answered on the connection they came from
+    }
+    return *_market;
+}
+
+void DeribitSession::send_json(const Request& request, rapidjson::Document& params, WSSession* link)
 {
     rapidjson::Document d;
     rapidjson::Document::AllocatorType& alloc = d.GetAllocator();
     d.SetObject();
 
-    std::string id = uuids::to_string(_uuid_gen());
-
-    d.SetObject();
-    d.AddMember("jsonrc", "2.0", alloc);
-    d.AddMember("id", rapidjson::Value(id.c_str(), alloc), alloc);
-    d.AddMember("method", rapidjson::Value(method.c_str(), alloc), alloc);
+    d.AddMember("jsonrpc", "2.0", alloc);
+    d.AddMember("id", rapidjson::Value(request.id), alloc);
+    d.AddMember("method", rapidjson::Value(request.name(), alloc), alloc);
     d.AddMember("params", params, params.GetAllocator());
 
     rapidjson::StringBuffer buffer;
@@ -45,18 +215,40 @@ void DeribitSession::send_json(const std::string& method, rapidjson::Document& p
 
     d.Accept(writer);
     const std::string& msg = std::string(buffer.GetString(), buffer.GetSize());
-    _session.send(msg);
 
-    rapidjson::Document doc;
-    doc.CopyFrom(d["params"], doc.GetAllocator());
-    _requests.insert({id, std::make_pair(method, std::move(doc))});
+    if (link == nullptr && _trading && request.method == Method::PublicSetHeartbeat)
+    {
+        // both connections are watched, the second reply finds the request
+        // already released and is dropped
+        _trading->send(msg);
+        _market->send(msg);
+        return;
+    }
+    this->transmit(request, msg, link);
+}
+
+void DeribitSession::transmit(const Request& request, const std::string& msg, WSSession* link)
+{
+    if (_replay)
+    {
+        _replay->capture(msg);
+        return;
+    }
+    (link != nullptr ? *link : this->route(request)).send(msg);
 }
 
 void DeribitSession::send(const std::string& method)
 {
     rapidjson::Document d;
     d.SetObject();
-    this->send_json(method, d);
+
+    Request& request = this->new_request(method_from_name(method));
+    if (request.method == Method::Other)
+    {
+        request.other_method = method;
+    }
+
+    this->send_json(request, d);
 }
 
 void DeribitSession::send(const std::string& method, const std::map < std::string, boost::variant<std::string, double>>& params)
@@ -65,25 +257,160 @@ void DeribitSession::send(const std::string& method, const std::map < std::strin
     rapidjson::Document::AllocatorType& alloc = d.GetAllocator();
     d.SetObject();
 
+    Request& request = this->new_request(method_from_name(method));
+    if (request.method == Method::Other)
+    {
+        request.other_method = method;
+    }
+
     for (auto& it : params)
     {
         if (it.second.which() == 0) // string
         {
+            const std::string& value = boost::get<std::string>(it.second);
             d.AddMember(
                 rapidjson::Value(it.first.c_str(), alloc),
-                rapidjson::Value(boost::get<std::string>(it.second).c_str(), alloc),
+                rapidjson::Value(value.c_str(), alloc),
                 alloc);
+
+            if (it.first == "order_id")
+            {
+                request.order_id = value;
+            }
         }
         else if (it.second.which() == 1) // double
         {
+            const double value = boost::get<double>(it.second);
             d.AddMember(
                 rapidjson::Value(it.first.c_str(), alloc),
-                rapidjson::Value(boost::get<double>(it.second)),
+                rapidjson::Value(value),
                 alloc);
+
+            if (it.first == "amount")
+            {
+                request.amount = value;
+            }
+            else if (it.first == "price")
+            {
+                request.price = value;
+            }
         }
     }
 
-    this->send_json(method, d);
+    this->send_json(request, d);
+}
+
+int64_t DeribitSession::send(OrderTemplate& order, double amount, double price)
+{
+    const auto now = this->now();
+
+    if (order.method() != Method::PrivateEdit)
+    {
+        if (!_credits.take(now))
+        {
+            return 0;
+        }
+        return this->send_order(order, amount, price);
+    }
+
+    auto edit = std::find_if(_edits.begin(), _edits.end(),
+        [&order](const OrderEdit& e) { return e.order_id == order.order_id(); });
+    if (edit == _edits.end())
+    {
+        _edits.push_back({ &order, order.order_id(), 0, 0, false, false });
+        edit = _edits.end() - 1;
+    }
+
+    if (edit->in_flight || !_credits.take(now))
+    {
+        if (!edit->held)
+        {
+            edit->held = true;
+            _held_edits++;
+        }
+        edit->order = &order;
+        edit->amount = amount;
+        edit->price = price;
+        return 0;
+    }
+
+    edit->in_flight = true;
+    return this->send_order(order, amount, price);
+}
+
+int64_t DeribitSession::send_order(OrderTemplate& order, double amount, double price)
+{
+    Request& request = this->new_request(order.method());
+    request.order_id = order.order_id();
+    request.amount = amount;
+    request.price = price;
+
+    const int64_t id = request.id;
+    this->transmit(request, order.render(id, amount, price));
+    return id;
+}
+
+void DeribitSession::edit_done(const Request& request)
+{
+    if (request.method != Method::PrivateEdit)
+    {
+        return;
+    }
+
+    // a held edit goes out with the next flush
+    for (size_t i = 0; i < _edits.size(); i++)
+    {
+        if (_edits[i].order_id == request.order_id)
+        {
+            _edits[i].in_flight = false;
+            if (!_edits[i].held)
+            {
+                std::swap(_edits[i], _edits.back());
+                _edits.pop_back();
+            }
+            break;
+        }
+    }
+}
+
+void DeribitSession::flush_edits()
+{
+    if (_held_edits == 0)
+    {
+        return;
+    }
+
+    const auto now = this->now();
+    for (size_t i = 0; i < _edits.size(); )
+    {
+        if (_edits[i].held && !_edits[i].in_flight)
+        {
+            OrderEdit& edit = _edits[i];
+            if (edit.order->order_id() != edit.order_id)
+            {
+                // the template moved on to another order
+                edit.held = false;
+                _held_edits--;
+            }
+            else if (_credits.take(now))
+            {
+                edit.held = false;
+                edit.in_flight = true;
+                _held_edits--;
+                this->send_order(*edit.order, edit.amount, edit.price);   // may call back into send()
+            }
+        }
+
+        if ((i < _edits.size()) && !_edits[i].held && !_edits[i].in_flight)
+        {
+            std::swap(_edits[i], _edits.back());
+            _edits.pop_back();
+        }
+        else
+        {
+            i++;
+        }
+    }
 }
 
 void DeribitSession::subscribe(const std::vector<std::string>& channels)
@@ -93,24 +420,343 @@ void DeribitSession::subscribe(const std::vector<std::string>& channels)
     d.SetObject();
 
     rapidjson::Value channels_json(rapidjson::kArrayType);
+    rapidjson::Value private_json(rapidjson::kArrayType);
 
     for (auto& channel : channels)
     {
-        channels_json.PushBack(rapidjson::Value(channel.c_str(), alloc), alloc);
+        _channels.add(channel);
+
+        // user.* channels need the authenticated connection
+        auto& target = (_trading && channel.compare(0, 5, "user.") == 0) ? private_json : channels_json;
+        target.PushBack(rapidjson::Value(channel.c_str(), alloc), alloc);
     }
 
-    d.AddMember("channels", channels_json, alloc);
+    if (!private_json.Empty())
+    {
+        rapidjson::Document p;
+        p.SetObject();
+        p.AddMember("channels", rapidjson::Value(private_json, p.GetAllocator()), p.GetAllocator());
+        this->send_json(this->new_request(Method::PublicSubscribe), p, _trading.get());
+    }
 
-    this->send_json("public/subscribe", d);
+    if (!channels_json.Empty())
+    {
+        d.AddMember("channels", channels_json, alloc);
+        this->send_json(this->new_request(Method::PublicSubscribe), d, _market.get());
+    }
 }
 
+// Runs until the connection drops, then reconnects with exponential backoff
+// (unless disabled) and carries on
 void DeribitSession::run()
 {
-    while (_session.is_open())
+    if (_lock_memory)
+    {
+        lock_memory();
+    }
+    if (_replay)
+    {
+        this->run_replay();
+        return;
+    }
+
+    auto delay = std::chrono::milliseconds(kReconnectMinDelayMs);
+    while (true)
+    {
+        auto connected = std::chrono::steady_clock::now();
+        this->run_connected();
+        if (!_reconnect || stop_requested())
+        {
+            return;
+        }
+
+        // a connection that held for a while starts the backoff over
+        if (std::chrono::steady_clock::now() - connected > std::chrono::milliseconds(kReconnectMaxDelayMs))
+        {
+            delay = std::chrono::milliseconds(kReconnectMinDelayMs);
+        }
+
+        while (true)
+        {
+            this->log() << "Connection lost, reconnecting in " << delay.count() << "ms." << std::endl;
+            std::this_thread::sleep_for(delay);
+            delay = std::min(2 * delay, std::chrono::milliseconds(kReconnectMaxDelayMs));
+            if (stop_requested())
+            {
+                return;
+            }
+
+            try
+            {
+                this->reconnect();
+                break;
+            }
+            catch (const boost::system::system_error& e)
+            {
+                this->log() << "Reconnection failed: " << e.what() << std::endl;
+            }
+        }
+    }
+}
+
+void DeribitSession::run_replay()
+{
+    pin_thread(_strategy_core);
+
+    this->drain_injected();     // answers to the requests sent so far
+    while (const Record* record = _replay->next())
+    {
+        if (record->type == RecordType::Channel)
+        {
+            // channels the session did not subscribe to are skipped
+            if (static_cast<size_t>(record->channel) >= _replay_channels.size())
+            {
+                _replay_channels.resize(record->channel + 1, NameTable::kNone);
+            }
+            _replay_channels[record->channel] = _channels.find(_replay->channel_name(record->channel));
+            continue;
+        }
+        if (record->checkpoint)
+        {
+            continue;   // the session resyncs as it would live
+        }
+
+        const int channel = _replay_channels[record->channel];
+        if (channel == NameTable::kNone)
+        {
+            this->drain_injected();     // the exchange may still have reacted to it
+            continue;
+        }
+
+        _received = record->received;
+        if (record->type == RecordType::Json)
+        {
+            this->replay_json(channel, record->json, record->json_length);
+        }
+        else if (_book_deltas)
+        {
+            this->on_book_notification(channel, record->book);
+            this->flush_edits();
+        }
+        else
+        {
+            _replay_data.str("");
+            _replay_data << record->book;
+            const std::string& data = _replay_data.str();
+            this->replay_json(channel, data.data(), data.size());
+        }
+        this->drain_injected();
+    }
+
+    const Replay::Stats stats = _replay->stats();
+    const double seconds = std::chrono::duration<double>(stats.elapsed).count();
+    this->log() << "Replay: " << stats.notifications << " notifications ("
+        << stats.book_updates << " book updates) in " << seconds * 1000 << "ms, "
+        << (seconds > 0 ? stats.book_updates / seconds : 0) << " book updates/s, "
+        << stats.recorded_ns / 1e9 << "s recorded, " << stats.sent << " messages sent" << std::endl;
+}
+
+void DeribitSession::drain_injected()
+{
+    while (_replay->injected(_replay_message))
+    {
+        this->process_document(&_replay_message[0]);
+    }
+}
+
+// rebuilds the notification around the recorded data, parsed like a live one
+void DeribitSession::replay_json(int channel, const char* data, size_t length)
+{
+    const std::string& name = _channels.name(channel);
+    _replay_message.assign("{\"jsonrpc\":\"2.0\",\"method\":\"subscription\",\"params\":{\"channel\":\"");
+    _replay_message.append(name);
+    _replay_message.append("\",\"data\":");
+    _replay_message.append(data, length);
+    _replay_message.append("}}");
+    this->process_document(&_replay_message[0]);
+}
+
+void DeribitSession::run_connected()
+{
+    if (_spin)
+    {
+        _market->set_low_latency(_busy_poll_us, this->log());
+        if (_trading)
+        {
+            _trading->set_low_latency(_busy_poll_us, this->log());
+        }
+    }
+    if (_pipeline)
+    {
+        this->run_pipeline();
+        return;
+    }
+
+    pin_thread(_io_core);
+    if (_async_io || _spin || _trading)
+    {
+        // orders sent from the callbacks are queued rather than written
+        // before the next read is armed; two connections can only be read
+        // this way
+        _market->start_async([this](char* msg) { _source = _market.get(); this->process(msg); });
+        if (_trading)
+        {
+            _trading->start_async([this](char* msg) { _source = _trading.get(); this->process(msg); });
+        }
+        this->drive();
+        return;
+    }
+
+    try
+    {
+        // a stop request is noticed with the next message
+        while (_market->is_open() && !stop_requested())
+        {
+            this->process(_market->recv_inplace());
+        }
+    }
+    catch (const boost::system::system_error& e)
+    {
+        this->log() << "Connection closed: " << e.what() << std::endl;
+    }
+}
+
+// In spin mode the reactor is polled without a timeout, so a message is
+// picked up as soon as it is in the socket rather than after the thread is
+// woken up. The io_context stops once no read is re-armed, or on a stop
+// request, which is looked for between slices of running it.
+void DeribitSession::drive()
+{
+    while (!_ioc->stopped())
+    {
+        if (_spin)
+        {
+            _ioc->poll();
+        }
+        else
+        {
+            _ioc->run_for(std::chrono::milliseconds(kStopPollMs));
+        }
+
+        if (stop_requested())
+        {
+            _ioc->stop();
+        }
+    }
+}
+
+void DeribitSession::process(char* msg)
+{
+    _received = _source->received();
+
+    // book notifications are applied without building a DOM
+    if (_book_deltas && _book_parser.parse(msg, _channels, _book_delta_channel, _book_delta))
     {
-        rapidjson::Document d;
-        d.Parse(_session.recv().c_str());
-        this->on_message(d);
+        this->on_book_notification(_book_delta_channel, _book_delta);
+        this->flush_edits();
+        return;
+    }
+
+    this->process_document(msg);
+}
+
+void DeribitSession::process_document(char* msg)
+{
+    // nothing from the previous message is referenced anymore
+    _value_allocator.Clear();
+    _stack_allocator.Clear();
+
+    ArenaDocument d(&_value_allocator, kStackArenaSize / 4, &_stack_allocator);
+    d.ParseInsitu(msg);
+    this->on_message(d);
+
+    this->expire_requests();
+    this->flush_edits();    // credits refilled since
+}
+
+void DeribitSession::run_pipeline()
+{
+    _io_done.store(false, std::memory_order_relaxed);
+    // the network thread only decodes, everything touching requests and
+    // strategy state stays on this thread; sends are posted to the socket
+    _market->start_async([this](char* msg) { this->push_frame(_market.get(), msg); });
+    if (_trading)
+    {
+        _trading->start_async([this](char* msg) { this->push_frame(_trading.get(), msg); });
+    }
+    std::thread io([this]()
+        {
+            pin_thread(_io_core);
+            this->drive();
+            _io_done.store(true, std::memory_order_release);
+        });
+
+    pin_thread(_strategy_core);
+    while (true)
+    {
+        bool done = _io_done.load(std::memory_order_acquire);
+        InboundFrame* frame = _inbound.front();
+        if (frame != nullptr)
+        {
+            this->drain_frame(*frame);
+            _inbound.pop();
+        }
+        else if (done)
+        {
+            break;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+    io.join();
+
+    if (_queued_frames > 0)
+    {
+        this->log() << "Pipeline: " << _queued_frames << " messages, receive to strategy "
+            << (_queue_delay_total / _queued_frames).count() << "ns mean, "
+            << _queue_delay_max.count() << "ns max" << std::endl;
+    }
+}
+
+// network thread
+void DeribitSession::push_frame(WSSession* source, char* msg)
+{
+    InboundFrame* frame;
+    while ((frame = _inbound.claim()) == nullptr)
+    {
+        std::this_thread::yield();  // strategy thread is behind
+    }
+
+    frame->received = source->received();
+    frame->source = source;
+    frame->book = _book_deltas && _book_parser.parse(msg, _channels, frame->channel, frame->delta);
+    if (!frame->book)
+    {
+        frame->text.assign(msg);
+    }
+    _inbound.publish();
+}
+
+// strategy thread
+void DeribitSession::drain_frame(InboundFrame& frame)
+{
+    auto delay = std::chrono::nanoseconds(timestamp_now().ns - frame.received.ns);
+    _queue_delay_total += delay;
+    _queue_delay_max = std::max(_queue_delay_max, delay);
+    _queued_frames++;
+
+    _source = frame.source;
+    _received = frame.received;
+    if (frame.book)
+    {
+        this->on_book_notification(frame.channel, frame.delta);
+        this->flush_edits();
+    }
+    else
+    {
+        this->process_document(&frame.text[0]);
     }
 }
 
@@ -118,25 +764,38 @@ void DeribitSession::on_message(const rapidjson::Value& message) {
 
     if (message.HasMember("method") && message["method"].IsString()) // Notification
     {
-        const std::string& method = message["method"].GetString();
-        auto& params = message["params"];
-        on_notification(method, params);
+        const auto& method = message["method"];
+        const auto& params = message["params"];
+        Notification notification = notification_from_name(method.GetString(), method.GetStringLength());
+
+        if (notification == Notification::Subscription)
+        {
+            const auto& channel = params["channel"];
+            on_subscription_notification(
+                _channels.find(channel.GetString(), channel.GetStringLength()),
+                params["data"]);
+        }
+        else
+        {
+            on_notification(notification, params);
+        }
     }
     else if (message.HasMember("result"))
     {
-        const auto& it = _requests.find(message["id"].GetString());
-        auto request = std::move(it->second);
-        _requests.erase(it);
+        const int64_t id = message["id"].GetInt64();
+        Request* request = _requests.find(id);
+        if (request == nullptr)
+        {
+            return; // already given up on
+        }
 
-        const std::string& method = request.first;
-        const auto& params = request.second;
         const auto& result = message["result"];
 
         // -----------------------------------------------------------
         // public / auth
         // -----------------------------------------------------------
 
-        if (method == "public/auth")
+        if (request->method == Method::PublicAuth)
         {
             // std::cout << "Receiving new authorization tokens." << std::endl;
             _refresh_token = result["refresh_token"].GetString();
@@ -144,32 +803,47 @@ void DeribitSession::on_message(const rapidjson::Value& message) {
         }
         else
         {
-            on_response(method, params, result);
+            on_response(*request, result);
         }
+
+        this->edit_done(*request);
+        _requests.release(id);
     }
     else if (message.HasMember("error"))
     {
-        const auto& it = _requests.find(message["id"].GetString());
-        auto request = std::move(it->second);
-        _requests.erase(it);
+        const int64_t id = message["id"].GetInt64();
+        Request* request = _requests.find(id);
+        if (request == nullptr)
+        {
+            return; // already given up on
+        }
 
-        const std::string& method = request.first;
-        const auto& params = request.second;
         const auto& error = message["error"];
         int code = error["code"].GetInt();
         const auto& msg = error["message"].GetString();
 
-        if (code == 13009)
+        // a held edit still goes out, failing in turn if the order is gone
+        this->edit_done(*request);
+
+        if (request->method == Method::PublicAuth && !_refresh_token.empty())
+        {
+            _requests.release(id);
+
+            // refresh token no longer valid, start over from the credentials
+            _refresh_token.clear();
+            this->authenticate();
+        }
+        else if (code == 13009)
         {
+            _requests.release(id);
+
             // std::cout << "Expired access_token, requesting a new one." << std::endl;
-            this->send("public/auth", {
-                    {"grant_type", "refresh_token"},
-                    {"refresh_token", _refresh_token}
-                });
+            this->authenticate();
         }
         else
         {
-            on_error(method, params, code, msg);
+            on_error(*request, code, msg);
+            _requests.release(id);
         }
     }
 }
@@ -178,28 +852,76 @@ void DeribitSession::on_message(const rapidjson::Value& message) {
 SubscriptionWriter::SubscriptionWriter(
     const URI& uri,
     const std::string& fname,
-    const std::vector<std::string>& channels) :
-    DeribitSession({ uri, "", "" })
+    const std::vector<std::string>& channels,
+    double tick_size,
+    bool direct,
+    bool tsc,
+    bool split) :
+    DeribitSession({ uri, "", "" }),
+    _flushed_ns(0)
 {
+    this->enable_book_deltas();
     this->subscribe(channels);
 
-    _ofile.open(fname);
+    if (split)
+    {
+        std::vector<std::string> segments;
+        for (auto& channel : channels)
+        {
+            segments.push_back(segment_name(fname, channel));
+            _writers.emplace_back(new RecordWriter(segments.back(), direct, tsc));
+        }
+        write_segment_list(fname, segments);
+    }
+    else
+    {
+        _writers.emplace_back(new RecordWriter(fname, direct, tsc));
+    }
+
+    for (size_t i = 0; i < channels.size(); i++)
+    {
+        const int handle = this->channel_handle(channels[i]);
+        if (static_cast<size_t>(handle) >= _channel_writers.size())
+        {
+            _channel_writers.resize(handle + 1, nullptr);
+        }
+        _channel_writers[handle] = _writers[split ? i : 0].get();
+        _channel_writers[handle]->channel(handle, channels[i], tick_size);
+    }
 }
 
-SubscriptionWriter::~SubscriptionWriter()
+void SubscriptionWriter::on_subscription_notification(
+    int channel,
+    const rapidjson::Value& data
+)
 {
-    _ofile.close();
+    _json.Clear();
+    rapidjson::Writer<rapidjson::StringBuffer> writer(_json);
+    data.Accept(writer);
+    _channel_writers.at(channel)->write(channel, this->received(), _json.GetString(), _json.GetSize());
+    this->flush();
 }
 
-void SubscriptionWriter::on_notification(
-    const std::string& method,
-    const rapidjson::Value& params
+void SubscriptionWriter::on_book_notification(
+    int channel,
+    const BookDelta& delta
 )
 {
-    if (method != "subscription")
+    _channel_writers.at(channel)->write(channel, this->received(), delta);
+    this->flush();
+}
+
+void SubscriptionWriter::flush()
+{
+    const int64_t now = this->received().ns;
+    if (now - _flushed_ns < kFlushIntervalNs)
     {
         return;
     }
 
-    _ofile << params["data"] << std::endl;
+    _flushed_ns = now;
+    for (auto& writer : _writers)
+    {
+        writer->flush();
+    }
 }
\ No newline at end of file
@@ -1,45 +1,258 @@
 #pragma once
 #include "connection.hpp"
+#include "book_parser.hpp"
+#include "credit_limiter.hpp"
+#include "order_template.hpp"
+#include "request.hpp"
+#include "name_table.hpp"
+#include "spsc_ring.hpp"
+#include "recording.hpp"
+#include "replay.hpp"
+#include "timestamp.hpp"
 
-#include <boost/uuid/uuid.hpp>
-#include <boost/uuid/uuid_io.hpp>
-#include <boost/uuid/uuid_generators.hpp>
 #include <boost/variant.hpp>
 
 #include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
 
-#include <unordered_map>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
 #include <string>
 
-namespace uuids = boost::uuids;         // from <boost/uuid/uuid.hpp>
-
 
 std::ostream& operator<<(std::ostream&, const rapidjson::Value&);
 
 
+// Document whose parser stack also lives in a memory pool
+typedef rapidjson::GenericDocument<
+    rapidjson::UTF8<>,
+    rapidjson::MemoryPoolAllocator<>,
+    rapidjson::MemoryPoolAllocator<>
+> ArenaDocument;
+
+
 struct API_Settings
 {
     URI uri;
     std::string client_id;
     std::string client_secret;
+    bool async_io = false;          // asynchronous reads and queued writes
+    bool order_connection = true;   // orders and private channels on their own connection
+    bool pipeline = false;          // network and strategy on separate threads
+    int io_core = -1;               // core to pin the socket thread to, negative for none
+    int strategy_core = -1;         // core to pin the strategy thread to, negative for none
+    bool spin = false;              // busy-poll the socket instead of blocking on it
+    int busy_poll_us = 0;           // SO_BUSY_POLL budget in spin mode, 0 for none
+    bool lock_memory = false;       // mlockall before running
+    bool reconnect = true;          // reconnect when the connection drops
+    double credits = 50000;         // size of the order credit pool of the account
+    double credit_refill = 10000;   // order credits refilled per second
+    double order_credits = 500;     // order credits each buy, sell and edit costs
+    std::string replay = "";        // recording to replay instead of connecting
+    double replay_speed = 0;        // against the recorded times, 0 for as fast as possible
+    double replay_from = 0;         // seconds into the recording to start from
+    std::shared_ptr<const DecodedRecording> replay_recording = nullptr;  // decoded once and shared, instead of replay
+    bool quiet = false;             // no logging, for sessions run side by side
+};
+
+
+// Inbound message handed from the network thread to the strategy thread,
+// either already decoded as a book delta or as the raw text
+struct InboundFrame
+{
+    WSSession* source;
+    bool book;
+    int channel;
+    BookDelta delta;
+    std::string text;
+    Timestamp received;
 };
 
 
 class DeribitSession
 {
 private:
-    WSSession _session;
-    uuids::random_generator _uuid_gen;
-    std::unordered_map<std::string, std::pair<std::string, rapidjson::Document>> _requests;
+    // Market data comes on one connection and, once authenticated, orders
+    // and private channels go on another, so neither queues behind the other.
+    // Both are read on the same io_context and feed the same callbacks.
+    API_Settings _settings;
+    std::ostream _quiet_log;    // without a buffer, drops everything
+    std::ostream* _log;
+    std::unique_ptr<net::io_context> _ioc;
+    std::unique_ptr<WSSession> _market;
+    std::unique_ptr<WSSession> _trading;
+    WSSession* _source;         // connection of the message being handled
+    Timestamp _received;        // and when it was received
+
+    // Reconnection backoff, doubling from the min delay
+    static const int kReconnectMinDelayMs = 500;
+    static const int kReconnectMaxDelayMs = 30000;
+
+    // how often a running io_context looks for a stop request
+    static const int kStopPollMs = 100;
+    static std::atomic<bool> _stop;
+
+    void connect();
+    void authenticate();        // with the refresh token if there is one
+
+    // New connections, authenticated and subscribed to every channel so far.
+    // Requests left on the old ones time out.
+    void reconnect();
+    void run_connected();
+    RequestTable _requests;
+    NameTable _channels;        // subscribed channels
     std::string _refresh_token;
     std::string _access_token;
 
+    // Messages are parsed in situ with values and parser stack taken from a
+    // preallocated arena, which is reset before each message.
+    static const size_t kValueArenaSize = 1 << 20;
+    static const size_t kStackArenaSize = 1 << 18;
+    std::unique_ptr<char[]> _arena;
+    rapidjson::MemoryPoolAllocator<> _value_allocator;
+    rapidjson::MemoryPoolAllocator<> _stack_allocator;
+
+    // "book.*" notifications are decoded by a SAX parser when enabled
+    bool _book_deltas;
+    BookParser _book_parser;
+    BookDelta _book_delta;
+    int _book_delta_channel;
+
+    // Requests without a response after this are given up on
+    static const int kRequestTimeoutSeconds = 30;
+
+    bool _async_io;
+    bool _spin;
+    int _busy_poll_us;
+    bool _lock_memory;
+    bool _reconnect;
+
+    // handles one inbound message, parsed in place
+    void process(
+        char*                       // message
+    );
+
+    void process_document(
+        char*                       // message
+    );
+
+    // Pipeline mode: the network thread owns the sockets and fills the ring,
+    // the thread calling run() drains it and runs the callbacks
+    static const size_t kInboundCapacity = 1024;
+    bool _pipeline;
+    int _io_core;
+    int _strategy_core;
+    SpscRing<InboundFrame, kInboundCapacity> _inbound;
+    std::atomic<bool> _io_done;
+
+    // time from receiving frames to handling them
+    size_t _queued_frames;
+    std::chrono::nanoseconds _queue_delay_total;
+    std::chrono::nanoseconds _queue_delay_max;
+
+    void run_pipeline();
+    void push_frame(
+        WSSession*,                 // connection it came on
+        char*                       // message
+    );
+    void drain_frame(
+        InboundFrame&
+    );
+
+    Request& new_request(
+        Method                      // method
+    );
+
+    void expire_requests();
+
+    // the clock of requests and credits, the recorded one when replaying
+    std::chrono::steady_clock::time_point now() const;
+
+    // times out a request, freeing its slot
+    void give_up(
+        Request&
+    );
+
+    // Orders are sent within the exchange credits. Edits are sent one at a
+    // time per order; targets given meanwhile are held, the latest replacing
+    // the others, and go out once it is answered and credits allow.
+    struct OrderEdit
+    {
+        OrderTemplate* order;
+        std::string order_id;
+        double amount;
+        double price;
+        bool in_flight;
+        bool held;
+    };
+    CreditLimiter _credits;
+    std::vector<OrderEdit> _edits;
+    size_t _held_edits;
+
+    int64_t send_order(
+        OrderTemplate&,             // request template
+        double,                     // amount
+        double                      // price
+    );
+    void edit_done(
+        const Request&              // answered or given up on
+    );
+    void flush_edits();
+
+    // connection a request goes out on
+    WSSession& route(
+        const Request&              // request
+    );
+
     void send_json(
-        const std::string&,         // methods
-        rapidjson::Document&        // params
+        const Request&,             // request
+        rapidjson::Document&,       // params
+        WSSession* = nullptr        // connection, routed by method if null
     );
 
+    void transmit(
+        const Request&,             // request
+        const std::string&,         // rendered message
+        WSSession* = nullptr        // connection, routed by method if null
+    );
+
+    // Replay mode: no connections, the recorded notifications go through
+    // the same callbacks and sent messages are captured. Book records are
+    // handed over decoded, or as JSON to sessions without book deltas.
+    std::unique_ptr<Replay> _replay;
+    std::vector<int> _replay_channels;  // recording channel id to handle
+    std::ostringstream _replay_data;
+    std::string _replay_message;
+
+    void run_replay();
+
+    // handles what the simulated exchange injected, if any
+    void drain_injected();
+
+    void replay_json(
+        int,                        // channel handle
+        const char*,                // data
+        size_t                      // length
+    );
+
+    // runs the io_context, busy-polling it in spin mode
+    void drive();
+
+protected:
+    // routes book notifications to on_book_notification instead of the DOM
+    void enable_book_deltas();
+
+    // when the message being handled was received
+    const Timestamp& received() const { return _received; }
+
+    // handle of a subscribed channel, as given to the callbacks
+    int channel_handle(const std::string&) const;
+    const std::string& channel_name(int) const;
+
 public:
     DeribitSession(const API_Settings&);
 
@@ -52,55 +265,113 @@ public:
         const std::map < std::string, boost::variant<std::string, double>>& // key-value params
     );
 
+    // Sends a pre-rendered request, patching in its amount and price, and
+    // returns its request id. Edits are always taken, though possibly held;
+    // 0 if nothing went out now: a held edit, or a new order without the
+    // credits for it.
+    int64_t send(
+        OrderTemplate&,             // request template
+        double,                     // amount
+        double                      // price
+    );
+
     void subscribe(
         const std::vector<std::string>& // channels
     );
 
     void run();
 
+    // Has every session return from run() as soon as it notices, e.g. from
+    // a signal handler, so that it is destroyed and its files are closed
+    static void request_stop() { _stop.store(true, std::memory_order_relaxed); }
+    static bool stop_requested() { return _stop.load(std::memory_order_relaxed); }
+
+    // source of the session in replay mode, null otherwise
+    Replay* replay() { return _replay.get(); }
+
+    // where the session and its strategy log: std::cout, unless quiet
+    std::ostream& log() { return *_log; }
+
     virtual void on_message(
         const rapidjson::Value&     // message
     );
 
     virtual void on_notification(
-        const std::string&,         // method
+        Notification,               // method
         const rapidjson::Value&     // params (content)
     )
     {};
 
+    virtual void on_subscription_notification(
+        int,                        // channel handle
+        const rapidjson::Value&     // data
+    )
+    {};
+
+    virtual void on_book_notification(
+        int,                        // channel handle
+        const BookDelta&            // decoded book changes
+    )
+    {};
+
     virtual void on_response(
-        const std::string&,         // method
-        const rapidjson::Value&,    // request message
+        const Request&,             // request
         const rapidjson::Value&     // response contents
     )
     {};
 
     virtual void on_error(
-        const std::string&,         // method
-        const rapidjson::Value&,    // request message
+        const Request&,             // request
         int,                        // error code
         const std::string&          // error message
     )
     {};
+
+    // connections were rebuilt, state kept from before may be out of date
+    virtual void on_reconnect()
+    {};
+
+    virtual void on_timeout(
+        const Request&              // request left without response
+    )
+    {};
 };
 
 
+// Records the notifications of the subscribed channels in the binary format
+// of recording.hpp, book channels as decoded deltas and the others as JSON
 class SubscriptionWriter : public DeribitSession
 {
 private:
-    std::ofstream _ofile;
+    std::vector<std::unique_ptr<RecordWriter>> _writers;
+    std::vector<RecordWriter*> _channel_writers;    // by channel handle
+    rapidjson::StringBuffer _json;
+
+    // recordings are flushed at least this often, in receive time, so that
+    // a recorder killed outright loses little
+    static const int64_t kFlushIntervalNs = 1000000000;
+    int64_t _flushed_ns;
+
+    void flush();
 
 public:
     SubscriptionWriter(
         const URI&,                 // uri,
         const std::string&,         // file name
-        const std::vector<std::string>& // channels
+        const std::vector<std::string>&, // channels
+        double,                     // tick size of the book prices
+        bool,                       // O_DIRECT writes
+        bool,                       // record time stamp counters
+        bool                        // one segment file per channel
     );
 
-    ~SubscriptionWriter();
+    void on_subscription_notification(
+        int,                        // channel handle
+        const rapidjson::Value&     // data
+    );
 
-    void on_notification(
-        const std::string&,         // method
-        const rapidjson::Value&     // params (content)
+    void on_book_notification(
+        int,                        // channel handle
+        const BookDelta&            // decoded book changes
     );
 };
\ No newline at end of file
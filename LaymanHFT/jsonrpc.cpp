@@ -0,0 +1,161 @@
+#include "jsonrpc.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+
+double number_param(const rapidjson::Value& params, const char* key)
+{
+    if (!params.HasMember(key))
+    {
+        return NAN;
+    }
+    const auto& value = params[key];
+    if (value.IsNumber())
+    {
+        return value.GetDouble();
+    }
+    return value.IsString() ? std::atof(value.GetString()) : NAN;
+}
+
+std::string string_param(const rapidjson::Value& params, const char* key)
+{
+    return (params.HasMember(key) && params[key].IsString()) ? params[key].GetString() : "";
+}
+
+bool bool_param(const rapidjson::Value& params, const char* key)
+{
+    if (!params.HasMember(key))
+    {
+        return false;
+    }
+    const auto& value = params[key];
+    return value.IsBool() ? value.GetBool() : (value.IsString() && std::strcmp(value.GetString(), "true") == 0);
+}
+
+void write_error(JsonWriter& w, int64_t id, int code, const char* message)
+{
+    w.StartObject();
+    w.Key("jsonrpc");
+    w.String("2.0");
+    w.Key("id");
+    w.Int64(id);
+    w.Key("error");
+    w.StartObject();
+    w.Key("code");
+    w.Int(code);
+    w.Key("message");
+    w.String(message);
+    w.EndObject();
+    w.EndObject();
+}
+
+void begin_response(JsonWriter& w, int64_t id)
+{
+    w.StartObject();
+    w.Key("jsonrpc");
+    w.String("2.0");
+    w.Key("id");
+    w.Int64(id);
+    w.Key("result");
+}
+
+void end_response(JsonWriter& w)
+{
+    w.EndObject();
+}
+
+void write_order(JsonWriter& w, const OrderFields& order)
+{
+    w.StartObject();
+    w.Key("order_id");
+    w.String(order.order_id);
+    w.Key("instrument_name");
+    w.String(order.instrument);
+    w.Key("direction");
+    w.String(order.buy ? "buy" : "sell");
+    w.Key("order_type");
+    w.String("limit");
+    w.Key("order_state");
+    w.String(order.state);
+    w.Key("price");
+    w.Double(order.price);
+    w.Key("amount");
+    w.Double(order.amount);
+    w.Key("filled_amount");
+    w.Double(order.filled);
+    w.Key("post_only");
+    w.Bool(order.post_only);
+    w.Key("label");
+    w.String(order.label);
+    if (order.timestamp != 0)
+    {
+        w.Key("last_update_timestamp");
+        w.Int64(order.timestamp);
+    }
+    w.EndObject();
+}
+
+void write_trade(JsonWriter& w, const TradeFields& trade)
+{
+    w.StartObject();
+    w.Key("trade_id");
+    w.String(trade.trade_id);
+    w.Key("order_id");
+    w.String(trade.order->order_id);
+    w.Key("instrument_name");
+    w.String(trade.order->instrument);
+    w.Key("direction");
+    w.String(trade.order->buy ? "buy" : "sell");
+    w.Key("state");
+    w.String(trade.order->state);
+    w.Key("price");
+    w.Double(trade.price);
+    w.Key("amount");
+    w.Double(trade.amount);
+    w.Key("liquidity");
+    w.String(trade.maker ? "M" : "T");
+    w.Key("label");
+    w.String(trade.order->label);
+    if (trade.timestamp != 0)
+    {
+        w.Key("timestamp");
+        w.Int64(trade.timestamp);
+    }
+    w.EndObject();
+}
+
+void write_changes(JsonWriter& w, const char* channel, const TradeFields& trade, double position)
+{
+    w.StartObject();
+    w.Key("jsonrpc");
+    w.String("2.0");
+    w.Key("method");
+    w.String("subscription");
+    w.Key("params");
+    w.StartObject();
+    w.Key("channel");
+    w.String(channel);
+    w.Key("data");
+    w.StartObject();
+    w.Key("instrument_name");
+    w.String(trade.order->instrument);
+    w.Key("trades");
+    w.StartArray();
+    write_trade(w, trade);
+    w.EndArray();
+    w.Key("orders");
+    w.StartArray();
+    write_order(w, *trade.order);
+    w.EndArray();
+    w.Key("position");
+    w.StartObject();
+    w.Key("instrument_name");
+    w.String(trade.order->instrument);
+    w.Key("size");
+    w.Double(position);
+    w.EndObject();
+    w.EndObject();
+    w.EndObject();
+    w.EndObject();
+}
\ No newline at end of file
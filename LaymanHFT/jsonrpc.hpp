@@ -0,0 +1,77 @@
+#pragma once
+
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include <cstdint>
+#include <string>
+
+
+// JSON-RPC messages of the simulated exchanges, the backtest and the mock
+// server, shaped as Deribit sends them
+
+typedef rapidjson::Writer<rapidjson::StringBuffer> JsonWriter;
+
+// numbers may be sent as strings, NAN if neither
+double number_param(const rapidjson::Value&, const char*);
+
+// "" if missing
+std::string string_param(const rapidjson::Value&, const char*);
+
+// true or "true"
+bool bool_param(const rapidjson::Value&, const char*);
+
+
+// An order as reported in responses and user.changes
+struct OrderFields
+{
+    const char* order_id = "";
+    const char* instrument = "";
+    bool buy = true;
+    const char* state = "open";
+    double price = 0;
+    double amount = 0;
+    double filled = 0;
+    bool post_only = false;
+    const char* label = "";
+    int64_t timestamp = 0;          // of the last update in ms, 0 to leave out
+};
+
+// A trade of one of the orders
+struct TradeFields
+{
+    const char* trade_id = "";
+    const OrderFields* order = nullptr;
+    double price = 0;
+    double amount = 0;
+    bool maker = true;
+    int64_t timestamp = 0;          // in ms, 0 to leave out
+};
+
+void write_error(
+    JsonWriter&,
+    int64_t,                        // request id
+    int,                            // code
+    const char*                     // message
+);
+
+// Opens the response and its result key; the result follows, then
+// end_response() closes it
+void begin_response(
+    JsonWriter&,
+    int64_t                         // request id
+);
+void end_response(JsonWriter&);
+
+void write_order(JsonWriter&, const OrderFields&);
+void write_trade(JsonWriter&, const TradeFields&);
+
+// user.changes notification of a trade, with the order after it and the
+// position of the instrument
+void write_changes(
+    JsonWriter&,
+    const char*,                    // channel
+    const TradeFields&,
+    double                          // position
+);
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include "lz4_block.hpp"
+#include <lz4.h>
+#include <climits>
+#include <stdexcept>
+
+
+Lz4Compressor::Lz4Compressor() :
+    _state(new char[LZ4_sizeofState()])
+{
+}
+
+size_t Lz4Compressor::bound(size_t n)
+{
+    if (n > LZ4_MAX_INPUT_SIZE)
+    {
+        throw std::runtime_error("Block too large for LZ4");
+    }
+    return static_cast<size_t>(LZ4_compressBound(static_cast<int>(n)));
+}
+
+size_t Lz4Compressor::compress(const char* src, size_t n, char* dst)
+{
+    // acceleration 1, the default; the state is reset by the call
+    const int size = static_cast<int>(bound(n));
+    const int stored = LZ4_compress_fast_extState(_state.get(), src, dst, static_cast<int>(n), size, 1);
+    if (stored <= 0)
+    {
+        throw std::runtime_error("LZ4 compression failed");
+    }
+    return static_cast<size_t>(stored);
+}
+
+bool lz4_decompress(const char* src, size_t n, char* dst, size_t raw_size)
+{
+    if ((n > INT_MAX) || (raw_size > INT_MAX))
+    {
+        return false;
+    }
+    const int size = LZ4_decompress_safe(src, dst, static_cast<int>(n), static_cast<int>(raw_size));
+    return (size >= 0) && (static_cast<size_t>(size) == raw_size);
+}
\ No newline at end of file
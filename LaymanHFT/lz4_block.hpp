@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+
+// LZ4 block format (no frame), as used for recording blocks, by liblz4 so
+// that the blocks stay readable by the standard tools.
+
+// Compresses blocks one after the other with the same LZ4 state, rather
+// than setting one up for each
+class Lz4Compressor
+{
+public:
+    Lz4Compressor();
+
+    // room the compressor may need for n input bytes
+    static size_t bound(size_t n);
+
+    // Compresses n bytes into dst, which holds at least bound(n) bytes;
+    // returns the compressed size
+    size_t compress(const char* src, size_t n, char* dst);
+
+private:
+    std::unique_ptr<char[]> _state;     // LZ4_sizeofState() bytes
+};
+
+// Decompresses a block into exactly raw_size bytes; false if the block is
+// corrupt or does not decompress to that size
+bool lz4_decompress(const char* src, size_t n, char* dst, size_t raw_size);
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include "mapped_file.hpp"
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& fname) :
+    _data(nullptr),
+    _size(0),
+    _file(INVALID_HANDLE_VALUE),
+    _mapping(nullptr)
+{
+    _file = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    LARGE_INTEGER size;
+    if ((_file == INVALID_HANDLE_VALUE) || !GetFileSizeEx(_file, &size))
+    {
+        if (_file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(_file);
+        }
+        throw std::runtime_error("Could not open " + fname);
+    }
+    _size = static_cast<size_t>(size.QuadPart);
+    if (_size == 0)
+    {
+        return;     // empty files cannot be mapped
+    }
+
+    _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (_mapping != nullptr)
+    {
+        _data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (_data == nullptr)
+    {
+        if (_mapping != nullptr)
+        {
+            CloseHandle(_mapping);
+        }
+        CloseHandle(_file);
+        throw std::runtime_error("Could not map " + fname);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data != nullptr)
+    {
+        UnmapViewOfFile(_data);
+        CloseHandle(_mapping);
+    }
+    CloseHandle(_file);
+}
+#else
+MappedFile::MappedFile(const std::string& fname) :
+    _data(nullptr),
+    _size(0)
+{
+    const int fd = ::open(fname.c_str(), O_RDONLY);
+    struct stat st;
+    if ((fd < 0) || (fstat(fd, &st) != 0))
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        throw std::runtime_error("Could not open " + fname);
+    }
+    _size = static_cast<size_t>(st.st_size);
+    if (_size == 0)
+    {
+        ::close(fd);
+        return;     // empty files cannot be mapped
+    }
+
+    void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);    // the mapping keeps the file open
+    if (data == MAP_FAILED)
+    {
+        throw std::runtime_error("Could not map " + fname);
+    }
+
+    // read front to back, the kernel can read ahead aggressively
+    madvise(data, _size, MADV_SEQUENTIAL);
+    _data = static_cast<const char*>(data);
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data != nullptr)
+    {
+        munmap(const_cast<char*>(_data), _size);
+    }
+}
+#endif
\ No newline at end of file
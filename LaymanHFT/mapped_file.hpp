@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+
+// Read-only memory mapping of a whole file, for reading recordings without
+// copying them; pages are faulted in as they are first touched
+class MappedFile
+{
+private:
+    const char* _data;
+    size_t _size;
+#ifdef _WIN32
+    void* _file;
+    void* _mapping;
+#endif
+
+public:
+    explicit MappedFile(const std::string&);     // file name, throws if it cannot be mapped
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+};
\ No newline at end of file
@@ -0,0 +1,37 @@
+#include "name_table.hpp"
+#include <cstring>
+
+
+int NameTable::add(const std::string& name)
+{
+    int handle = this->find(name);
+    if (handle == kNone)
+    {
+        handle = static_cast<int>(_names.size());
+        _names.push_back(name);
+    }
+    return handle;
+}
+
+int NameTable::find(const char* str, size_t length) const
+{
+    for (size_t i = 0; i < _names.size(); ++i)
+    {
+        const std::string& name = _names[i];
+        if ((name.size() == length) && (std::memcmp(name.data(), str, length) == 0))
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return kNone;
+}
+
+int NameTable::find(const std::string& name) const
+{
+    return this->find(name.data(), name.size());
+}
+
+const std::string& NameTable::name(int handle) const
+{
+    return _names.at(handle);
+}
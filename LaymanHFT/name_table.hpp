@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+// Interns the names a session deals with (e.g. channels) into compact
+// integer handles. Lookups scan the handful of names registered, comparing
+// lengths first only as an early exit: names of the same length, such as
+// the books of two instruments, are then compared by their characters.
+class NameTable
+{
+public:
+    static const int kNone = -1;
+
+    // Handle of the name, registering it if needed
+    int add(const std::string&);
+
+    // kNone if the name is not registered
+    int find(const char*, size_t) const;
+    int find(const std::string&) const;
+
+    const std::string& name(int) const;
+    size_t size() const { return _names.size(); }
+
+private:
+    std::vector<std::string> _names;
+};
@@ -0,0 +1,228 @@
+#include "order_manager.hpp"
+
+#include <cassert>
+#include <stdexcept>
+
+
+namespace
+{
+    const char* const kStateNames[] = {
+        "empty",
+        "pending new",
+        "live",
+        "pending edit",
+        "pending cancel",
+        "filled"
+    };
+}
+
+
+const char* order_state_name(OrderState state)
+{
+    return kStateNames[static_cast<size_t>(state)];
+}
+
+
+OrderManager::OrderManager(size_t slots) :
+    _slots(slots),
+    _requests(RequestTable::kCapacity, PendingRequest{ 0, -1 })
+{
+    // at most a quarter full, so that probes stay short
+    size_t capacity = 16;
+    while (capacity < 4 * slots)
+    {
+        capacity *= 2;
+    }
+    _orders.assign(capacity, -1);
+    _order_mask = capacity - 1;
+
+    for (OrderSlot& slot : _slots)
+    {
+        slot.order_id.reserve(OrderTemplate::kOrderIdWidth);
+        slot.edit = OrderTemplate::edit("");
+    }
+}
+
+int OrderManager::find_request(int64_t request_id) const
+{
+    const PendingRequest& entry = _requests[request_id & (RequestTable::kCapacity - 1)];
+    return ((request_id > 0) && (entry.id == request_id)) ? entry.slot : -1;
+}
+
+int OrderManager::find_order(const std::string& order_id) const
+{
+    if (order_id.empty())
+    {
+        return -1;
+    }
+
+    for (size_t i = _hash(order_id) & _order_mask; _orders[i] >= 0; i = (i + 1) & _order_mask)
+    {
+        if (_slots[_orders[i]].order_id == order_id)
+        {
+            return _orders[i];
+        }
+    }
+    return -1;
+}
+
+void OrderManager::sent_new(int i, int64_t request_id, double price, double amount)
+{
+    OrderSlot& slot = _slots[i];
+    this->transition(i, OrderState::PendingNew, slot.free());
+
+    slot.request_id = request_id;
+    slot.price = price;
+    slot.amount = amount;
+    slot.filled = 0;
+    _requests[request_id & (RequestTable::kCapacity - 1)] = { request_id, i };
+}
+
+void OrderManager::placed(int i, const std::string& order_id, double filled)
+{
+    OrderSlot& slot = _slots[i];
+    this->transition(i, OrderState::Live, slot.state == OrderState::PendingNew);
+
+    this->unmap_request(i);
+    slot.order_id = order_id;
+    slot.edit.set_order_id(order_id);
+    slot.filled = filled;
+    this->map_order(i);
+}
+
+void OrderManager::adopt(int i, const std::string& order_id, double price, double amount, double filled)
+{
+    OrderSlot& slot = _slots[i];
+    this->transition(i, OrderState::Live, slot.free());
+
+    slot.order_id = order_id;
+    slot.edit.set_order_id(order_id);
+    slot.price = price;
+    slot.amount = amount;
+    slot.filled = filled;
+    this->map_order(i);
+}
+
+void OrderManager::sent_edit(int i, double price, double amount)
+{
+    OrderSlot& slot = _slots[i];
+    this->transition(i, OrderState::PendingEdit, slot.open());
+
+    slot.price = price;
+    slot.amount = amount;
+}
+
+void OrderManager::edited(int i, double price, double amount)
+{
+    OrderSlot& slot = _slots[i];
+    if ((slot.state == OrderState::PendingEdit) && (price == slot.price) && (amount == slot.amount))
+    {
+        slot.state = OrderState::Live;
+    }
+}
+
+void OrderManager::sent_cancel(int i)
+{
+    OrderSlot& slot = _slots[i];
+    this->transition(i, OrderState::PendingCancel, slot.open());
+
+    // the session drops held edits once their template moved on
+    slot.edit.set_order_id("");
+}
+
+void OrderManager::fill(int i, double amount, bool complete)
+{
+    OrderSlot& slot = _slots[i];
+    slot.filled += amount;
+
+    if (complete)
+    {
+        this->transition(i, OrderState::Filled, !slot.free());
+        this->unmap_request(i);
+        this->unmap_order(i);
+    }
+}
+
+void OrderManager::release(int i)
+{
+    this->transition(i, OrderState::Empty, true);
+    this->unmap_request(i);
+    this->unmap_order(i);
+}
+
+void OrderManager::clear()
+{
+    for (size_t i = 0; i < _slots.size(); i++)
+    {
+        this->release(static_cast<int>(i));
+    }
+}
+
+void OrderManager::transition(int i, OrderState state, bool allowed)
+{
+    OrderSlot& slot = _slots[i];
+    if (!allowed)
+    {
+        throw std::runtime_error(std::string("Order slot cannot go from ") +
+            order_state_name(slot.state) + " to " + order_state_name(state));
+    }
+    slot.state = state;
+}
+
+void OrderManager::map_order(int i)
+{
+    assert(this->find_order(_slots[i].order_id) < 0);
+
+    size_t j = _hash(_slots[i].order_id) & _order_mask;
+    while (_orders[j] >= 0)
+    {
+        j = (j + 1) & _order_mask;
+    }
+    _orders[j] = i;
+}
+
+void OrderManager::unmap_order(int i)
+{
+    OrderSlot& slot = _slots[i];
+    if (slot.order_id.empty())
+    {
+        return;
+    }
+
+    size_t j = _hash(slot.order_id) & _order_mask;
+    while ((_orders[j] >= 0) && (_orders[j] != i))
+    {
+        j = (j + 1) & _order_mask;
+    }
+
+    if (_orders[j] == i)
+    {
+        // backward shift: entries after the hole move up unless that would
+        // put them before their home position
+        size_t hole = j;
+        for (size_t k = (hole + 1) & _order_mask; _orders[k] >= 0; k = (k + 1) & _order_mask)
+        {
+            const size_t home = _hash(_slots[_orders[k]].order_id) & _order_mask;
+            if (((k - home) & _order_mask) >= ((k - hole) & _order_mask))
+            {
+                _orders[hole] = _orders[k];
+                hole = k;
+            }
+        }
+        _orders[hole] = -1;
+    }
+
+    slot.order_id.clear();
+    slot.edit.set_order_id("");
+}
+
+void OrderManager::unmap_request(int i)
+{
+    OrderSlot& slot = _slots[i];
+    PendingRequest& entry = _requests[slot.request_id & (RequestTable::kCapacity - 1)];
+    if ((slot.request_id > 0) && (entry.id == slot.request_id))
+    {
+        entry = { 0, -1 };
+    }
+    slot.request_id = 0;
+}
\ No newline at end of file
@@ -0,0 +1,144 @@
+#pragma once
+#include "order_template.hpp"
+#include "request.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+// Life of an order slot. Sending a request moves it to a pending state, and
+// the answers, fills and errors from the exchange settle it again.
+enum class OrderState : unsigned char
+{
+    Empty = 0,          // free, nothing at the exchange
+    PendingNew,         // new order sent, its order id not known yet
+    Live,               // resting at the exchange
+    PendingEdit,        // edit sent or held, price and amount are its target
+    PendingCancel,      // cancel sent
+    Filled              // done, free to quote again
+};
+
+const char* order_state_name(OrderState);
+
+
+// An order of the strategy. Slots are allocated up front and reused, and
+// so are their strings and edit templates.
+struct OrderSlot
+{
+    OrderState state = OrderState::Empty;
+    std::string order_id;       // empty until the exchange gave it
+    int64_t request_id = 0;     // of the new order, while pending
+    double price = 0;           // latest sent or confirmed
+    double amount = 0;          // total, filled part included
+    double filled = 0;
+    OrderTemplate edit;         // private/edit, pointed at the order
+
+    bool free() const { return (state == OrderState::Empty) || (state == OrderState::Filled); }
+
+    // at the exchange, and can be edited or cancelled
+    bool open() const { return (state == OrderState::Live) || (state == OrderState::PendingEdit); }
+};
+
+
+// Order slots of a strategy, with their states and O(1) lookups by the
+// request id of pending new orders and by exchange order id. Transitions
+// throw if the slot is not in a state they apply to; handlers check the
+// state first wherever an answer may race with a later request.
+class OrderManager
+{
+public:
+    explicit OrderManager(
+        size_t                      // number of slots
+    );
+
+    OrderSlot& slot(int i) { return _slots[i]; }
+    const OrderSlot& slot(int i) const { return _slots[i]; }
+    size_t size() const { return _slots.size(); }
+
+    // -1 if no slot has it
+    int find_request(int64_t) const;
+    int find_order(const std::string&) const;
+
+    // Empty or Filled -> PendingNew
+    void sent_new(
+        int,                        // slot
+        int64_t,                    // request id
+        double,                     // price
+        double                      // amount
+    );
+
+    // PendingNew -> Live, the exchange took the order
+    void placed(
+        int,                        // slot
+        const std::string&,         // order id
+        double                      // filled amount
+    );
+
+    // Empty or Filled -> Live, an open order found when reconciling
+    void adopt(
+        int,                        // slot
+        const std::string&,         // order id
+        double,                     // price
+        double,                     // amount
+        double                      // filled amount
+    );
+
+    // Live or PendingEdit -> PendingEdit, with a new target
+    void sent_edit(
+        int,                        // slot
+        double,                     // price
+        double                      // amount
+    );
+
+    // PendingEdit -> Live once the latest target is confirmed; an answer
+    // to an earlier edit leaves it pending
+    void edited(
+        int,                        // slot
+        double,                     // price
+        double                      // amount
+    );
+
+    // Live or PendingEdit -> PendingCancel; edits still held are dropped
+    void sent_cancel(
+        int                         // slot
+    );
+
+    // Adds to the filled amount, and moves the slot to Filled once done
+    void fill(
+        int,                        // slot
+        double,                     // amount
+        bool                        // complete
+    );
+
+    // -> Empty: cancelled, rejected, or found not to be open any more
+    void release(
+        int                         // slot
+    );
+
+    // every slot -> Empty
+    void clear();
+
+private:
+    struct PendingRequest
+    {
+        int64_t id;
+        int slot;
+    };
+
+    std::vector<OrderSlot> _slots;
+    std::vector<PendingRequest> _requests;  // by request id, as the RequestTable
+    std::vector<int> _orders;               // open addressing by order id, slot or -1
+    size_t _order_mask;
+    std::hash<std::string> _hash;
+
+    void transition(
+        int,                        // slot
+        OrderState,                 // new state
+        bool                        // allowed from the current one
+    );
+    void map_order(int);
+    void unmap_order(int);
+    void unmap_request(int);
+};
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "order_template.hpp"
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+
+bool format_number(char* dst, size_t width, double value)
+{
+    const double kScale = 1e8;  // 8 decimals, enough for prices and amounts
+    const double abs_value = std::abs(value);
+    char* p = dst + width;
+
+    if (abs_value < 9e10)
+    {
+        unsigned long long scaled = static_cast<unsigned long long>(std::llround(abs_value * kScale));
+        unsigned long long integer = scaled / static_cast<unsigned long long>(kScale);
+        unsigned long long fraction = scaled % static_cast<unsigned long long>(kScale);
+
+        if (fraction != 0)
+        {
+            int digits = 8;
+            while (fraction % 10 == 0)
+            {
+                fraction /= 10;
+                --digits;
+            }
+            if (p - dst <= digits)
+            {
+                return false;
+            }
+            for (; digits > 0; --digits, fraction /= 10)
+            {
+                *--p = '0' + fraction % 10;
+            }
+            *--p = '.';
+        }
+
+        do
+        {
+            if (p == dst)
+            {
+                return false;
+            }
+            *--p = '0' + integer % 10;
+            integer /= 10;
+        } while (integer != 0);
+    }
+    else
+    {
+        char buffer[32];
+        int n = std::snprintf(buffer, sizeof(buffer), "%.17g", abs_value);
+        if ((n < 0) || (static_cast<size_t>(n) >= width))
+        {
+            return false;
+        }
+        p -= n;
+        std::memcpy(p, buffer, n);
+    }
+
+    if (value < 0)
+    {
+        if (p == dst)
+        {
+            return false;
+        }
+        *--p = '-';
+    }
+
+    std::memset(dst, ' ', p - dst);
+    return true;
+}
+
+bool format_number(char* dst, size_t width, int64_t value)
+{
+    uint64_t abs_value = (value < 0) ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    char* p = dst + width;
+
+    do
+    {
+        if (p == dst)
+        {
+            return false;
+        }
+        *--p = '0' + abs_value % 10;
+        abs_value /= 10;
+    } while (abs_value != 0);
+
+    if (value < 0)
+    {
+        if (p == dst)
+        {
+            return false;
+        }
+        *--p = '-';
+    }
+
+    std::memset(dst, ' ', p - dst);
+    return true;
+}
+
+
+OrderTemplate::OrderTemplate() :
+    _method(Method::Other),
+    _id_pos(0),
+    _amount_pos(0),
+    _price_pos(0),
+    _order_id_pos(0)
+{
+}
+
+OrderTemplate::OrderTemplate(Method method, const std::string& params) :
+    _method(method),
+    _order_id_pos(0)
+{
+    _msg = "{\"jsonrpc\":\"2.0\",\"id\":";
+    _id_pos = _msg.size();
+    _msg.append(kIdWidth, ' ');
+    _msg += ",\"method\":\"" + std::string(method_name(method)) + "\",\"params\":{";
+    if (!params.empty())
+    {
+        _msg += params + ",";
+    }
+    _msg += "\"amount\":";
+    _amount_pos = _msg.size();
+    _msg.append(kNumberWidth, ' ');
+    _msg += ",\"price\":";
+    _price_pos = _msg.size();
+    _msg.append(kNumberWidth, ' ');
+    _msg += "}}";
+}
+
+OrderTemplate OrderTemplate::edit(const std::string& order_id)
+{
+    const std::string key = "\"order_id\":";
+    OrderTemplate request(Method::PrivateEdit, key + std::string(kOrderIdWidth, ' '));
+    request._order_id_pos = request._msg.find(key) + key.size();
+    request._order_id.reserve(kOrderIdWidth);
+    request.set_order_id(order_id);
+    return request;
+}
+
+void OrderTemplate::set_order_id(const std::string& order_id)
+{
+    if ((_order_id_pos == 0) ||
+        (order_id.size() + 2 > kOrderIdWidth) ||
+        (order_id.find_first_of("\"\\") != std::string::npos))
+    {
+        throw std::runtime_error("Order id does not fit in the template");
+    }
+
+    // quoted, then padded with spaces
+    char* p = &_msg[_order_id_pos];
+    *p++ = '"';
+    std::memcpy(p, order_id.data(), order_id.size());
+    p += order_id.size();
+    *p++ = '"';
+    std::memset(p, ' ', kOrderIdWidth - order_id.size() - 2);
+
+    _order_id = order_id;
+}
+
+const std::string& OrderTemplate::render(int64_t id, double amount, double price)
+{
+    if (!format_number(&_msg[_id_pos], kIdWidth, id) ||
+        !format_number(&_msg[_amount_pos], kNumberWidth, amount) ||
+        !format_number(&_msg[_price_pos], kNumberWidth, price))
+    {
+        throw std::runtime_error("Number does not fit in the template");
+    }
+
+    return _msg;
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+#include "request.hpp"
+
+#include <cstdint>
+#include <string>
+
+
+// Writes a number right-aligned in a fixed-width field, padded with leading
+// spaces (valid JSON whitespace). Returns false if it does not fit.
+bool format_number(
+    char*,                      // destination
+    size_t,                     // width
+    double                      // value
+);
+
+bool format_number(
+    char*,                      // destination
+    size_t,                     // width
+    int64_t                     // value
+);
+
+
+// JSON-RPC request rendered once, with fixed-width slots for the request
+// id, amount and price which are patched in place before each send. Edits
+// also have a slot for the order id, so that one template can be pointed
+// at order after order.
+class OrderTemplate
+{
+public:
+    static const size_t kIdWidth = 20;
+    static const size_t kNumberWidth = 24;
+    static const size_t kOrderIdWidth = 64;     // quotes included
+
+    OrderTemplate();
+
+    OrderTemplate(
+        Method,                 // method
+        const std::string&      // fixed params, as comma-separated JSON members
+    );
+
+    // private/edit of the given order
+    static OrderTemplate edit(const std::string&);
+
+    // Points an edit at another order, in place; throws if the id does not
+    // fit or has characters to escape
+    void set_order_id(const std::string&);
+
+    // Patches the slots and returns the message, valid until the next call
+    const std::string& render(
+        int64_t,                // request id
+        double,                 // amount
+        double                  // price
+    );
+
+    Method method() const { return _method; }
+    const std::string& order_id() const { return _order_id; }
+    bool empty() const { return _msg.empty(); }
+
+private:
+    Method _method;
+    std::string _order_id;      // for edits
+    std::string _msg;
+    size_t _id_pos, _amount_pos, _price_pos;
+    size_t _order_id_pos;
+};
\ No newline at end of file
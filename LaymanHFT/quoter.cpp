@@ -0,0 +1,143 @@
+#include "quoter.hpp"
+
+#include <boost/algorithm/clamp.hpp>
+#include <cmath>
+#include <iostream>
+
+
+template<typename Side>
+Quoter<Side>::Quoter(
+    OrderManager& orders,
+    int first,
+    int levels,
+    const std::string& instrument,
+    const double* depths,
+    double level_spacing,
+    double order_amount,
+    double max_position_usd
+) :
+    kDepths{ depths[0], depths[1], depths[2] },
+    kLevelSpacing(level_spacing),
+    kOrderAmount(order_amount),
+    kMaxPositionUSD(max_position_usd),
+    _orders(orders),
+    _first(first),
+    _levels(levels),
+    _label(std::string(Side::kName) + "_" + instrument)
+{
+    _request = OrderTemplate(Side::kMethod,
+        "\"instrument_name\":\"" + instrument + "\","
+        "\"type\":\"limit\","
+        "\"post_only\":true,"
+        "\"label\":\"" + _label + "\"");
+}
+
+template<typename Side>
+double Quoter<Side>::quantity(double exposure) const
+{
+    return boost::algorithm::clamp(
+        10 * floor(kOrderAmount * (1 - exposure / kMaxPositionUSD) / 10),
+        0, 2 * kOrderAmount
+    );
+}
+
+template<typename Side>
+void Quoter<Side>::quote(DeribitSession& session, LadderBook& book, double position_usd)
+{
+    // the position counted positive when it is on this side
+    const double exposure = Side::kSign * position_usd;
+    const double qty = this->quantity(exposure);
+    const bool quoting = (exposure < kMaxPositionUSD) && (qty > 0);
+
+    for (int level = 0; level < _levels; level++)
+    {
+        const int i = _first + level;
+        OrderSlot& slot = _orders.slot(i);
+        const double offset = level * kLevelSpacing;
+        const double depths[3] = { kDepths[0] + offset, kDepths[1] + offset, kDepths[2] + offset };
+
+        switch (slot.state)
+        {
+        case OrderState::Empty:
+        case OrderState::Filled:
+        {
+            const double price = Side::levels(book).price_depth(depths[1]);
+            if (!quoting || !(price > 0))
+            {
+                break;
+            }
+
+            const int64_t request_id = session.send(_request, qty, price);
+            if (request_id == 0)
+            {
+                return;     // out of credits: tried again on the next book update
+            }
+            session.log() << "Sending order to " << Side::kName << " at " << price << " (level " << level << ")" << std::endl;
+            _orders.sent_new(i, request_id, price, qty);
+            break;
+        }
+
+        case OrderState::Live:
+        case OrderState::PendingEdit:
+        {
+            if (!quoting)
+            {
+                session.send("private/cancel", { {"order_id", slot.order_id} });
+                _orders.sent_cancel(i);
+                break;
+            }
+
+            // prices at the min, mid and max depths, from the most aggressive;
+            // -1 where the book is too thin to reach them
+            double prices[3];
+            Side::levels(book).price_depth(depths, prices, 3, slot.price, slot.amount - slot.filled);
+            if (!(prices[0] > 0) || !(prices[1] > 0) || !(prices[2] > 0))
+            {
+                break;      // left where it is until the book fills in
+            }
+
+            if (Side::ahead(slot.price, prices[0]) || Side::ahead(prices[2], slot.price))
+            {
+                // the amount counts what was filled already
+                const double amount = slot.filled + qty;
+                session.send(slot.edit, amount, prices[1]);
+                _orders.sent_edit(i, prices[1], amount);
+            }
+            break;
+        }
+
+        case OrderState::PendingNew:
+        case OrderState::PendingCancel:
+            break;      // settled by the answer
+        }
+    }
+}
+
+template<typename Side>
+bool Quoter<Side>::adopt(const std::string& order_id, double price, double amount, double filled)
+{
+    for (int i = _first; i < _first + _levels; i++)
+    {
+        if (_orders.slot(i).free())
+        {
+            _orders.adopt(i, order_id, price, amount, filled);
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename Side>
+int Quoter<Side>::open_orders() const
+{
+    int count = 0;
+    for (int i = _first; i < _first + _levels; i++)
+    {
+        count += _orders.slot(i).free() ? 0 : 1;
+    }
+    return count;
+}
+
+// explicit instantiations
+template class Quoter<BuySide>;
+template class Quoter<SellSide>;
\ No newline at end of file
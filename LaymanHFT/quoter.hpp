@@ -0,0 +1,89 @@
+#pragma once
+#include "book.hpp"
+#include "deribit_session.hpp"
+#include "order_manager.hpp"
+#include "order_template.hpp"
+
+#include <string>
+
+
+// Sides of the book as compile-time traits, so that quoting logic is
+// written once and each side compiles to its own straight-line code
+struct BuySide
+{
+    static constexpr Method kMethod = Method::PrivateBuy;
+    static constexpr double kSign = 1;      // of the position change on fills
+    static constexpr const char* kName = "buy";
+
+    static LadderBids& levels(LadderBook& book) { return book.bids; }
+
+    // first price is more aggressive than the second
+    static bool ahead(double a, double b) { return a > b; }
+};
+
+struct SellSide
+{
+    static constexpr Method kMethod = Method::PrivateSell;
+    static constexpr double kSign = -1;
+    static constexpr const char* kName = "sell";
+
+    static LadderAsks& levels(LadderBook& book) { return book.asks; }
+
+    static bool ahead(double a, double b) { return a < b; }
+};
+
+
+// Quotes one side with a ladder of post-only orders, one per level, each in
+// a slot of the order manager. Level i sits i level spacings deeper than
+// the depths: placed at its mid depth, and moved back there once its min or
+// max depth crosses it. The size shrinks as the position grows on that
+// side, and the orders are cancelled once it reaches the maximum.
+template<typename Side>
+class Quoter
+{
+public:
+    Quoter(
+        OrderManager&,
+        int,                        // first slot
+        int,                        // levels
+        const std::string&,         // instrument
+        const double*,              // min, mid and max depths
+        double,                     // level spacing
+        double,                     // order amount
+        double                      // maximum position (USD)
+    );
+
+    // places, moves or cancels the orders for the current book and position
+    void quote(
+        DeribitSession&,
+        LadderBook&,
+        double                      // position (USD)
+    );
+
+    // position change of a fill on this side
+    static double fill(double amount) { return Side::kSign * amount; }
+
+    // Takes an open order found when reconciling into a free slot; false
+    // if there is none left
+    bool adopt(
+        const std::string&,         // order id
+        double,                     // price
+        double,                     // amount
+        double                      // filled amount
+    );
+
+    int open_orders() const;
+    const std::string& label() const { return _label; }
+
+private:
+    const double kDepths[3];
+    const double kLevelSpacing;
+    const double kOrderAmount, kMaxPositionUSD;
+    OrderManager& _orders;
+    const int _first, _levels;
+    std::string _label;
+    OrderTemplate _request;         // private/buy or private/sell
+
+    // order size for the position along the side
+    double quantity(double) const;
+};
\ No newline at end of file
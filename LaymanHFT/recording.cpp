@@ -0,0 +1,1310 @@
+#include "recording.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace
+{
+    const char kMagic[8] = { 'L', 'H', 'F', 'T', 'R', 'E', 'C', '\0' };
+    const uint32_t kVersion = 4;
+    const uint32_t kFlagTsc = 1;
+    const size_t kHeaderSize = sizeof(kMagic) + 2 * sizeof(uint32_t);
+    const char kIndexMagic[8] = { 'L', 'H', 'F', 'T', 'I', 'D', 'X', '\0' };
+    const char kSegmentList[] = "LHFTSEG";
+
+    const unsigned char kBookSnapshot = 1;
+    const unsigned char kBookCheckpoint = 2;
+
+    // longest encodings, for reserving room up front
+    const size_t kMaxVarint = 10;
+    const size_t kMaxLevel = 1 + 2 * (kMaxVarint + sizeof(double));
+    const size_t kMaxTime = 2 * kMaxVarint;
+    const size_t kMaxBookHeader = 1 + 4 * kMaxVarint + 1 + kMaxTime;
+
+    const double kMaxIntegralQuantity = 4503599627370496.0;    // 2^52
+
+    inline uint64_t zigzag(int64_t v)
+    {
+        return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+    }
+
+    inline int64_t unzigzag(uint64_t v)
+    {
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+
+    inline char* put_varint(char* p, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            *p++ = static_cast<char>(v | 0x80);
+            v >>= 7;
+        }
+        *p++ = static_cast<char>(v);
+        return p;
+    }
+
+    // doubles are stored in the byte order of the machine (little endian)
+    inline char* put_double(char* p, double v)
+    {
+        std::memcpy(p, &v, sizeof(v));
+        return p + sizeof(v);
+    }
+
+    // Prices on the grid are tick differences shifted left, with the low
+    // bit set for a raw double. Ticks are converted back the way LadderSide
+    // does, and only used if that gives the same price.
+    char* put_price(char* p, const RecordChannel& channel, int64_t& last, double price)
+    {
+        if (channel.tick_size > 0)
+        {
+            const int64_t ticks = std::llround(price * channel.ticks_per_unit);
+            const double back = channel.tick_size <= 1 ?
+                ticks / channel.ticks_per_unit :
+                ticks * channel.tick_size;
+            if (back == price)
+            {
+                p = put_varint(p, zigzag(ticks - last) << 1);
+                last = ticks;
+                return p;
+            }
+        }
+        p = put_varint(p, 1);
+        return put_double(p, price);
+    }
+
+    char* put_quantity(char* p, double quantity)
+    {
+        if ((quantity >= 0) && (quantity < kMaxIntegralQuantity) && (quantity == std::floor(quantity)))
+        {
+            return put_varint(p, static_cast<uint64_t>(quantity) << 1);
+        }
+        p = put_varint(p, 1);
+        return put_double(p, quantity);
+    }
+
+    void set_tick_size(RecordChannel& channel, double tick_size)
+    {
+        channel.tick_size = tick_size;
+        channel.ticks_per_unit = (tick_size <= 0) ? 0 :
+            (tick_size <= 1 ? std::round(1 / tick_size) : 1 / tick_size);
+    }
+
+
+    // Bounds-checked decoding
+    class Input
+    {
+    public:
+        Input(const unsigned char*& pos, const unsigned char* end) : _pos(pos), _end(end) {}
+
+        uint64_t varint()
+        {
+            uint64_t v = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                const unsigned char byte = this->byte();
+                v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    return v;
+                }
+            }
+            throw std::runtime_error("Invalid varint in recording");
+        }
+
+        unsigned char byte()
+        {
+            this->need(1);
+            return *_pos++;
+        }
+
+        double real()
+        {
+            double v;
+            this->need(sizeof(v));
+            std::memcpy(&v, _pos, sizeof(v));
+            _pos += sizeof(v);
+            return v;
+        }
+
+        const char* bytes(size_t n)
+        {
+            this->need(n);
+            const char* p = reinterpret_cast<const char*>(_pos);
+            _pos += n;
+            return p;
+        }
+
+        double price(const RecordChannel& channel, int64_t& last)
+        {
+            const uint64_t v = this->varint();
+            if (v & 1)
+            {
+                return this->real();
+            }
+            last += unzigzag(v >> 1);
+            return channel.tick_size <= 1 ?
+                last / channel.ticks_per_unit :
+                last * channel.tick_size;
+        }
+
+        double quantity()
+        {
+            const uint64_t v = this->varint();
+            return (v & 1) ? this->real() : static_cast<double>(v >> 1);
+        }
+
+        size_t left() const { return static_cast<size_t>(_end - _pos); }
+
+    private:
+        const unsigned char*& _pos;
+        const unsigned char* _end;
+
+        void need(size_t n)
+        {
+            if (static_cast<size_t>(_end - _pos) < n)
+            {
+                throw std::runtime_error("Truncated recording");
+            }
+        }
+    };
+
+    // Raw file descriptors, so that writes can bypass the page cache
+#ifdef _WIN32
+    int open_output(const std::string& fname, bool)
+    {
+        return _open(fname.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+    }
+
+    bool write_output(int fd, const char* data, size_t size)
+    {
+        for (size_t written = 0; written < size; )
+        {
+            const int n = _write(fd, data + written, static_cast<unsigned int>(std::min<size_t>(size - written, 1 << 30)));
+            if (n <= 0)
+            {
+                return false;
+            }
+            written += n;
+        }
+        return true;
+    }
+
+    // writes at the offset, leaving the file position where it was
+    bool write_output_at(int fd, const char* data, size_t size, int64_t offset)
+    {
+        const __int64 position = _lseeki64(fd, 0, SEEK_CUR);
+        return (position >= 0) && (_lseeki64(fd, offset, SEEK_SET) == offset) &&
+            write_output(fd, data, size) && (_lseeki64(fd, position, SEEK_SET) == position);
+    }
+
+    bool set_direct(int, bool)
+    {
+        return true;
+    }
+
+    bool truncate_output(int fd, int64_t size)
+    {
+        return _chsize_s(fd, size) == 0;
+    }
+
+    void close_output(int fd)
+    {
+        _close(fd);
+    }
+#else
+    int open_output(const std::string& fname, bool direct)
+    {
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+        if (direct)
+        {
+            flags |= O_DIRECT;
+        }
+#else
+        if (direct)
+        {
+            std::cout << "O_DIRECT is not supported on this platform" << std::endl;
+        }
+#endif
+        return ::open(fname.c_str(), flags, 0644);
+    }
+
+    bool write_output(int fd, const char* data, size_t size)
+    {
+        for (size_t written = 0; written < size; )
+        {
+            const ssize_t n = ::write(fd, data + written, size - written);
+            if (n <= 0)
+            {
+                return false;
+            }
+            written += n;
+        }
+        return true;
+    }
+
+    // writes at the offset, leaving the file position where it was
+    bool write_output_at(int fd, const char* data, size_t size, int64_t offset)
+    {
+        for (size_t written = 0; written < size; )
+        {
+            const ssize_t n = ::pwrite(fd, data + written, size - written, offset + written);
+            if (n <= 0)
+            {
+                return false;
+            }
+            written += n;
+        }
+        return true;
+    }
+
+    // O_DIRECT writes must be whole pages, which the end of a file is not
+    bool set_direct(int fd, bool direct)
+    {
+#ifdef O_DIRECT
+        const int flags = fcntl(fd, F_GETFL);
+        return (flags >= 0) && (fcntl(fd, F_SETFL, direct ? (flags | O_DIRECT) : (flags & ~O_DIRECT)) == 0);
+#else
+        return true;
+#endif
+    }
+
+    bool truncate_output(int fd, int64_t size)
+    {
+        return ::ftruncate(fd, size) == 0;
+    }
+
+    void close_output(int fd)
+    {
+        ::close(fd);
+    }
+#endif
+
+    void read_levels(Input& in, const RecordChannel& channel, int64_t& last, std::vector<BookLevel>& levels)
+    {
+        // an action byte and at least a byte each for the price and quantity,
+        // so that a corrupt count cannot ask for a huge allocation
+        const uint64_t count = in.varint();
+        if (count > in.left() / 3)
+        {
+            throw std::runtime_error("Corrupt book record in recording");
+        }
+        levels.resize(static_cast<size_t>(count));
+        for (auto& level : levels)
+        {
+            const unsigned char action = in.byte();
+            if (action > static_cast<unsigned char>(BookAction::Delete))
+            {
+                throw std::runtime_error("Invalid change type");
+            }
+            level.action = static_cast<BookAction>(action);
+            level.price = in.price(channel, last);
+            level.quantity = in.quantity();
+        }
+    }
+}
+
+
+// ---------------------------------------------------------------
+// RecordWriter
+// ---------------------------------------------------------------
+
+RecordWriter::RecordWriter(const std::string& fname, bool direct, bool tsc) :
+    _buffer(kBufferSize),
+    _size(0),
+    _tsc(tsc),
+    _block_ns(0),
+    _block_change_id(0),
+    _full(kBufferSize),
+    _full_size(0),
+    _full_ns(0),
+    _full_change_id(0),
+    _flush(false),
+    _closing(false),
+    _direct(direct),
+    _offset(kHeaderSize),
+    _written(0),
+    _compressed(Lz4Compressor::bound(kBufferSize)),
+    _staging_memory(new char[kStagingSize + kAlignment]),
+    _staged(0)
+{
+    _fd = open_output(fname, direct);
+    if (_fd < 0)
+    {
+        throw std::runtime_error("Could not open " + fname);
+    }
+    _index_fd = open_output(fname + ".idx", false);
+    if ((_index_fd < 0) || !write_output(_index_fd, kIndexMagic, sizeof(kIndexMagic)))
+    {
+        if (_index_fd >= 0)
+        {
+            close_output(_index_fd);
+        }
+        close_output(_fd);
+        throw std::runtime_error("Could not open " + fname + ".idx");
+    }
+
+    const size_t misalignment = reinterpret_cast<uintptr_t>(_staging_memory.get()) % kAlignment;
+    _staging = _staging_memory.get() + (misalignment ? kAlignment - misalignment : 0);
+
+    std::memcpy(_staging, kMagic, sizeof(kMagic));
+    const uint32_t flags = tsc ? kFlagTsc : 0;
+    std::memcpy(_staging + sizeof(kMagic), &kVersion, sizeof(kVersion));
+    std::memcpy(_staging + sizeof(kMagic) + sizeof(kVersion), &flags, sizeof(flags));
+    _staged = kHeaderSize;
+
+    _thread = std::thread([this]() { this->write_blocks(); });
+}
+
+RecordWriter::~RecordWriter()
+{
+    try
+    {
+        this->hand_over();
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << std::endl;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closing = true;
+    }
+    _ready.notify_one();
+    _thread.join();
+
+    try
+    {
+        this->write_staged(true);
+        this->write_index(std::numeric_limits<int64_t>::max());
+        if (_direct && !truncate_output(_fd, _written))
+        {
+            throw std::runtime_error("Could not write the recording");   // padding of a flush left
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << std::endl;
+    }
+    close_output(_fd);
+    close_output(_index_fd);
+
+    const Stats& stats = _stats;
+    std::cout << "Recording: " << stats.blocks << " blocks, "
+        << stats.raw_bytes << " bytes compressed to " << stats.stored_bytes
+        << ", writer behind " << stats.stalls << " times ("
+        << std::chrono::duration_cast<std::chrono::milliseconds>(stats.stall_time).count() << "ms)" << std::endl;
+}
+
+void RecordWriter::flush()
+{
+    this->hand_over();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_error.empty())
+        {
+            throw std::runtime_error(_error);
+        }
+        _flush = true;
+    }
+    _ready.notify_one();
+}
+
+RecordWriter::Stats RecordWriter::stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+char* RecordWriter::reserve(size_t n)
+{
+    if (_buffer.size() - _size < n)
+    {
+        this->hand_over();
+    }
+    if (_size == 0)
+    {
+        this->begin_block();
+    }
+    if (_buffer.size() - _size < n)
+    {
+        _buffer.resize(_size + n);  // a record larger than a block
+    }
+    return _buffer.data() + _size;
+}
+
+// Starts the differences over, and repeats what a reader starting with the
+// block needs to know
+void RecordWriter::begin_block()
+{
+    _last_received = Timestamp();
+    _block_ns = _latest.ns;
+    _block_change_id = 0;
+    for (RecordChannel& channel : _channels)
+    {
+        channel.change_id = 0;
+        channel.bid_ticks = 0;
+        channel.ask_ticks = 0;
+    }
+
+    for (size_t id = 0; id < _channels.size(); id++)
+    {
+        const RecordChannel& channel = _channels[id];
+        if (channel.name.empty())
+        {
+            continue;   // not declared
+        }
+        const size_t n = 1 + 2 * kMaxVarint + channel.name.size() + sizeof(double);
+        if (_buffer.size() - _size < n)
+        {
+            _buffer.resize(_size + n);
+        }
+        char* begin = _buffer.data() + _size;
+        _size += this->put_channel(begin, static_cast<int>(id)) - begin;
+    }
+
+    for (size_t id = 0; id < _books.size(); id++)
+    {
+        if (_books[id] && _books[id]->valid)
+        {
+            this->write_checkpoint(static_cast<int>(id));
+        }
+    }
+}
+
+// the whole book as of the last record, as a snapshot
+void RecordWriter::write_checkpoint(int id)
+{
+    RecordChannel& channel = _channels[id];
+    const CheckpointBook& book = *_books[id];
+    const auto& bids = book.bids.levels();
+    const auto& asks = book.asks.levels();
+
+    const size_t n = kMaxBookHeader + kMaxLevel * (bids.size() + asks.size());
+    if (_buffer.size() - _size < n)
+    {
+        _buffer.resize(_size + n);
+    }
+    char* begin = _buffer.data() + _size;
+    char* p = begin;
+    *p++ = static_cast<char>(RecordType::Book);
+    p = put_varint(p, id);
+    p = this->put_received(p, _latest);
+    *p++ = kBookSnapshot | kBookCheckpoint;
+    p = put_varint(p, zigzag(book.change_id - channel.change_id));
+    channel.change_id = book.change_id;
+    if (_block_change_id == 0)
+    {
+        _block_change_id = book.change_id;
+    }
+
+    p = put_varint(p, bids.size());
+    for (const auto& level : bids)
+    {
+        *p++ = static_cast<char>(BookAction::New);
+        p = put_price(p, channel, channel.bid_ticks, level.first);
+        p = put_quantity(p, level.second);
+    }
+
+    p = put_varint(p, asks.size());
+    for (const auto& level : asks)
+    {
+        *p++ = static_cast<char>(BookAction::New);
+        p = put_price(p, channel, channel.ask_ticks, level.first);
+        p = put_quantity(p, level.second);
+    }
+
+    _size += p - begin;
+}
+
+// Swaps the current buffer with the one the background thread is done with
+void RecordWriter::hand_over()
+{
+    if (_size == 0)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_error.empty())
+    {
+        throw std::runtime_error(_error);
+    }
+    if (_full_size != 0)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        _done.wait(lock, [this]() { return _full_size == 0; });
+        _stats.stalls++;
+        _stats.stall_time += std::chrono::steady_clock::now() - start;
+    }
+
+    _buffer.swap(_full);
+    _full_size = _size;
+    _full_ns = _block_ns;
+    _full_change_id = _block_change_id;
+    _size = 0;
+    lock.unlock();
+    _ready.notify_one();
+}
+
+// background thread
+void RecordWriter::write_blocks()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _ready.wait(lock, [this]() { return (_full_size != 0) || _flush || _closing; });
+        if ((_full_size == 0) && !_flush)
+        {
+            return;     // closing with nothing left
+        }
+
+        const size_t size = _full_size;
+        const bool flush = _flush;
+        const int64_t ns = _full_ns;
+        const int64_t change_id = _full_change_id;
+        lock.unlock();
+        size_t stored = 0;
+        std::string error;
+        try
+        {
+            if (size != 0)
+            {
+                stored = this->write_block(_full.data(), size);
+                const int64_t offset = _offset;
+                _offset += 2 * sizeof(uint32_t) + stored;
+                _unindexed.insert(_unindexed.end(), { ns, change_id, offset, _offset });
+            }
+            if (flush)
+            {
+                this->write_tail();
+            }
+
+            // blocks are indexed once they are in the file, so that the
+            // index never points past its end
+            this->write_index(_written + (flush ? static_cast<int64_t>(_staged) : 0));
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+        }
+        lock.lock();
+
+        if (size != 0)
+        {
+            _stats.blocks++;
+            _stats.raw_bytes += size;
+            _stats.stored_bytes += stored;
+            _full_size = 0;     // another block may have come in during a flush
+        }
+        if (!error.empty())
+        {
+            _error = error;
+        }
+        if (flush)
+        {
+            _flush = false;
+        }
+        _done.notify_one();
+    }
+}
+
+size_t RecordWriter::write_block(const char* data, size_t size)
+{
+    size_t stored = _compressor.compress(data, size, _compressed.data());
+    const char* block = _compressed.data();
+    if (stored >= size)
+    {
+        stored = size;  // incompressible, kept as is
+        block = data;
+    }
+
+    const uint32_t sizes[2] = { static_cast<uint32_t>(size), static_cast<uint32_t>(stored) };
+    this->stage(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    this->stage(block, stored);
+    return stored;
+}
+
+// Appends to the staging buffer, writing out its aligned part when full
+void RecordWriter::stage(const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        const size_t n = std::min(size, kStagingSize - _staged);
+        std::memcpy(_staging + _staged, data, n);
+        _staged += n;
+        data += n;
+        size -= n;
+
+        if (_staged == kStagingSize)
+        {
+            this->write_staged(false);
+        }
+    }
+}
+
+void RecordWriter::write_staged(bool all)
+{
+    const size_t aligned = _staged - _staged % kAlignment;
+    if (!write_output(_fd, _staging, aligned))
+    {
+        throw std::runtime_error("Could not write the recording");
+    }
+    std::memmove(_staging, _staging + aligned, _staged - aligned);
+    _staged -= aligned;
+    _written += aligned;
+
+    if (all && (_staged > 0))
+    {
+        // the tail is not a whole number of pages
+        if (!set_direct(_fd, false) || !write_output(_fd, _staging, _staged))
+        {
+            throw std::runtime_error("Could not write the recording");
+        }
+        _written += _staged;
+        _staged = 0;
+    }
+}
+
+// Writes the staged tail where it belongs in the file, but keeps it staged
+// and the file position before it: it is written again, whole, once its
+// page fills. With O_DIRECT it goes out as a whole page padded with zeros,
+// which read as empty blocks; pages are not mixed with buffered writes,
+// which the page cache does not keep coherent with direct ones.
+void RecordWriter::write_tail()
+{
+    this->write_staged(false);
+    if (_staged == 0)
+    {
+        return;
+    }
+
+    size_t size = _staged;
+    if (_direct)
+    {
+        std::memset(_staging + _staged, 0, kAlignment - _staged);
+        size = kAlignment;
+    }
+    if (!write_output_at(_fd, _staging, size, _written))
+    {
+        throw std::runtime_error("Could not write the recording");
+    }
+}
+
+void RecordWriter::write_index(int64_t end)
+{
+    size_t n = 0;
+    while ((n < _unindexed.size()) && (_unindexed[n + 3] <= end))
+    {
+        if (!write_output(_index_fd, reinterpret_cast<const char*>(&_unindexed[n]), 3 * sizeof(int64_t)))
+        {
+            throw std::runtime_error("Could not write the recording index");
+        }
+        n += 4;
+    }
+    _unindexed.erase(_unindexed.begin(), _unindexed.begin() + n);
+}
+
+void RecordWriter::channel(int id, const std::string& name, double tick_size)
+{
+    char* begin = this->reserve(1 + 2 * kMaxVarint + name.size() + sizeof(double));
+
+    if (static_cast<size_t>(id) >= _channels.size())
+    {
+        _channels.resize(id + 1);
+        _books.resize(id + 1);
+    }
+    RecordChannel& channel = _channels[id];
+    channel.name = name;
+    set_tick_size(channel, tick_size);
+
+    _size += this->put_channel(begin, id) - begin;
+}
+
+char* RecordWriter::put_channel(char* p, int id)
+{
+    const RecordChannel& channel = _channels[id];
+    *p++ = static_cast<char>(RecordType::Channel);
+    p = put_varint(p, id);
+    p = put_varint(p, channel.name.size());
+    std::memcpy(p, channel.name.data(), channel.name.size());
+    return put_double(p + channel.name.size(), channel.tick_size);
+}
+
+char* RecordWriter::put_received(char* p, const Timestamp& received)
+{
+    p = put_varint(p, zigzag(received.ns - _last_received.ns));
+    if (_tsc)
+    {
+        p = put_varint(p, zigzag(static_cast<int64_t>(received.tsc - _last_received.tsc)));
+    }
+    _last_received = received;
+    _latest = received;
+    if (_block_ns == 0)
+    {
+        _block_ns = received.ns;
+    }
+    return p;
+}
+
+void RecordWriter::write(int id, const Timestamp& received, const BookDelta& delta)
+{
+    RecordChannel& channel = _channels.at(id);
+
+    char* begin = this->reserve(kMaxBookHeader + kMaxLevel * (delta.bids.size() + delta.asks.size()));
+    char* p = begin;
+    *p++ = static_cast<char>(RecordType::Book);
+    p = put_varint(p, id);
+    p = this->put_received(p, received);
+    *p++ = delta.snapshot ? kBookSnapshot : 0;
+    p = put_varint(p, zigzag(delta.change_id - channel.change_id));
+    if (!delta.snapshot)
+    {
+        p = put_varint(p, zigzag(static_cast<int64_t>(delta.change_id) - delta.prev_change_id));
+    }
+    channel.change_id = delta.change_id;
+    if (_block_change_id == 0)
+    {
+        _block_change_id = delta.change_id;
+    }
+
+    p = put_varint(p, delta.bids.size());
+    for (const auto& level : delta.bids)
+    {
+        *p++ = static_cast<char>(level.action);
+        p = put_price(p, channel, channel.bid_ticks, level.price);
+        p = put_quantity(p, level.quantity);
+    }
+
+    p = put_varint(p, delta.asks.size());
+    for (const auto& level : delta.asks)
+    {
+        *p++ = static_cast<char>(level.action);
+        p = put_price(p, channel, channel.ask_ticks, level.price);
+        p = put_quantity(p, level.quantity);
+    }
+
+    _size += p - begin;
+
+    // kept up to date for the checkpoints, until a gap
+    std::unique_ptr<CheckpointBook>& book = _books[id];
+    if (!book)
+    {
+        book.reset(new CheckpointBook);
+    }
+    if (delta.snapshot)
+    {
+        book->bids.clear();
+        book->asks.clear();
+        book->valid = true;
+    }
+    else if (book->change_id != delta.prev_change_id)
+    {
+        book->valid = false;
+    }
+    if (book->valid)
+    {
+        book->bids.update(delta.bids);
+        book->asks.update(delta.asks);
+    }
+    book->change_id = delta.change_id;
+}
+
+void RecordWriter::write(int id, const Timestamp& received, const char* json, size_t length)
+{
+    char* begin = this->reserve(1 + 2 * kMaxVarint + kMaxTime + length);
+    char* p = begin;
+    *p++ = static_cast<char>(RecordType::Json);
+    p = put_varint(p, id);
+    p = this->put_received(p, received);
+    p = put_varint(p, length);
+    std::memcpy(p, json, length);
+    _size += (p + length) - begin;
+}
+
+
+// ---------------------------------------------------------------
+// RecordReader
+// ---------------------------------------------------------------
+
+RecordReader::RecordReader(const std::string& fname) :
+    _merging(false),
+    _pass_checkpoints(false),
+    _refill(0)
+{
+    std::unique_ptr<Segment> segment(new Segment);
+    segment->file.reset(new MappedFile(fname));
+    const char* data = segment->file->data();
+    const size_t size = segment->file->size();
+    const size_t list_magic = sizeof(kSegmentList) - 1;
+
+    if ((size < list_magic) || (std::memcmp(data, kSegmentList, list_magic) != 0))
+    {
+        this->open(*segment, data, size);
+        this->open_index(*segment, fname);
+        _segments.push_back(std::move(segment));
+        return;
+    }
+
+    // segments named relative to the list, one per line after the magic
+    const size_t slash = fname.find_last_of("/\\");
+    const std::string dir = (slash == std::string::npos) ? "" : fname.substr(0, slash + 1);
+    const char* end = data + size;
+    const char* line = static_cast<const char*>(std::memchr(data, '\n', size));
+    while ((line != nullptr) && (line + 1 < end))
+    {
+        const char* begin = line + 1;
+        line = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+        std::string name(begin, (line != nullptr) ? line : end);
+        if (!name.empty() && (name.back() == '\r'))
+        {
+            name.pop_back();
+        }
+        if (name.empty())
+        {
+            continue;
+        }
+
+        std::unique_ptr<Segment> part(new Segment);
+        part->file.reset(new MappedFile(dir + name));
+        this->open(*part, part->file->data(), part->file->size());
+        this->open_index(*part, dir + name);
+        _segments.push_back(std::move(part));
+    }
+    if (_segments.empty())
+    {
+        throw std::runtime_error("No segments listed in " + fname);
+    }
+
+    _merging = _segments.size() > 1;
+    _refill = _segments.size();
+    for (auto& part : _segments)
+    {
+        part->ready = this->read(*part, part->record);
+    }
+}
+
+RecordReader::RecordReader(const char* data, size_t size) :
+    _merging(false),
+    _pass_checkpoints(false),
+    _refill(0)
+{
+    std::unique_ptr<Segment> segment(new Segment);
+    this->open(*segment, data, size);
+    _segments.push_back(std::move(segment));
+}
+
+void RecordReader::open(Segment& segment, const char* data, size_t size)
+{
+    if ((size < kHeaderSize) || (std::memcmp(data, kMagic, sizeof(kMagic)) != 0))
+    {
+        throw std::runtime_error("Not a recording");
+    }
+
+    uint32_t version;
+    std::memcpy(&version, data + sizeof(kMagic), sizeof(version));
+    if (version != kVersion)
+    {
+        throw std::runtime_error("Unsupported recording version");
+    }
+
+    uint32_t flags;
+    std::memcpy(&flags, data + sizeof(kMagic) + sizeof(version), sizeof(flags));
+    segment.tsc = (flags & kFlagTsc) != 0;
+
+    segment.begin = data;
+    segment.data = data + kHeaderSize;
+    segment.data_end = data + size;
+}
+
+// The index is optional, only seeking needs it
+void RecordReader::open_index(Segment& segment, const std::string& fname)
+{
+    try
+    {
+        segment.index_file.reset(new MappedFile(fname + ".idx"));
+    }
+    catch (const std::runtime_error&)
+    {
+        return;
+    }
+
+    const char* data = segment.index_file->data();
+    const size_t size = segment.index_file->size();
+    if ((size < sizeof(kIndexMagic)) || (std::memcmp(data, kIndexMagic, sizeof(kIndexMagic)) != 0))
+    {
+        throw std::runtime_error("Invalid recording index " + fname + ".idx");
+    }
+    segment.index = reinterpret_cast<const IndexEntry*>(data + sizeof(kIndexMagic));
+    segment.index_size = (size - sizeof(kIndexMagic)) / sizeof(IndexEntry);
+
+    // blocks of a killed recorder that never made it to the file
+    const int64_t file_size = segment.data_end - segment.begin;
+    while ((segment.index_size > 0) && (segment.index[segment.index_size - 1].offset >= file_size))
+    {
+        segment.index_size--;
+    }
+}
+
+// Moves on to the next block, decompressing it unless it was stored as is.
+// A last block cut short, as a killed recorder leaves it, ends the recording.
+bool RecordReader::next_block(Segment& segment)
+{
+    uint32_t sizes[2];
+    if (static_cast<size_t>(segment.data_end - segment.data) < sizeof(sizes))
+    {
+        segment.data = segment.data_end;
+        return false;
+    }
+    std::memcpy(sizes, segment.data, sizeof(sizes));
+
+    const size_t raw_size = sizes[0];
+    const size_t stored_size = sizes[1];
+    if (static_cast<size_t>(segment.data_end - segment.data) - sizeof(sizes) < stored_size)
+    {
+        segment.data = segment.data_end;
+        return false;
+    }
+    segment.data += sizeof(sizes);
+
+    const char* block = segment.data;
+    if (stored_size != raw_size)
+    {
+        segment.block.resize(raw_size);
+        if (!lz4_decompress(segment.data, stored_size, segment.block.data(), raw_size))
+        {
+            throw std::runtime_error("Corrupt block in recording");
+        }
+        block = segment.block.data();
+    }
+    segment.data += stored_size;
+
+    segment.pos = reinterpret_cast<const unsigned char*>(block);
+    segment.end = segment.pos + raw_size;
+
+    // the differences start over
+    segment.last_received = Timestamp();
+    for (RecordChannel& channel : segment.channels)
+    {
+        channel.change_id = 0;
+        channel.bid_ticks = 0;
+        channel.ask_ticks = 0;
+    }
+    return true;
+}
+
+bool RecordReader::next(Record& record)
+{
+    if (!_merging)
+    {
+        return this->read(*_segments.front(), record);
+    }
+
+    // the segment handed out last reads ahead again, once its record is done with
+    if (_refill < _segments.size())
+    {
+        Segment& segment = *_segments[_refill];
+        segment.ready = this->read(segment, segment.record);
+    }
+
+    // channels first, then by receive time
+    size_t first = _segments.size();
+    int64_t first_ns = 0;
+    for (size_t i = 0; i < _segments.size(); i++)
+    {
+        const Segment& segment = *_segments[i];
+        if (!segment.ready)
+        {
+            continue;
+        }
+        const int64_t ns = (segment.record.type == RecordType::Channel) ?
+            std::numeric_limits<int64_t>::min() : segment.record.received.ns;
+        if ((first == _segments.size()) || (ns < first_ns))
+        {
+            first = i;
+            first_ns = ns;
+        }
+    }
+    _refill = first;
+    if (first == _segments.size())
+    {
+        return false;
+    }
+
+    Record& ahead = _segments[first]->record;
+    record.type = ahead.type;
+    record.channel = ahead.channel;
+    record.received = ahead.received;
+    record.checkpoint = ahead.checkpoint;
+    record.json = ahead.json;
+    record.json_length = ahead.json_length;
+    std::swap(record.book, ahead.book);
+    return true;
+}
+
+bool RecordReader::read(Segment& segment, Record& record)
+{
+    while (true)
+    {
+        while (segment.pos == segment.end)
+        {
+            if (!this->next_block(segment))
+            {
+                return false;
+            }
+        }
+
+        Input in(segment.pos, segment.end);
+        record.type = static_cast<RecordType>(in.byte());
+        record.checkpoint = false;
+        const size_t id = in.varint();
+
+        if (record.type == RecordType::Channel)
+        {
+            if (id >= segment.channels.size())
+            {
+                segment.channels.resize(id + 1);
+                segment.ids.resize(id + 1, -1);
+            }
+            RecordChannel& channel = segment.channels[id];
+            const size_t length = in.varint();
+            const char* name = in.bytes(length);
+            const double tick_size = in.real();
+            if ((segment.ids[id] >= 0) && (channel.name.compare(0, std::string::npos, name, length) == 0))
+            {
+                continue;   // declared again by the block
+            }
+
+            channel.name.assign(name, length);
+            set_tick_size(channel, tick_size);
+            segment.ids[id] = static_cast<int>(_channels.size());
+            _channels.push_back(channel);
+            record.channel = segment.ids[id];
+            return true;
+        }
+
+        if ((id >= segment.channels.size()) || (segment.ids[id] < 0))
+        {
+            throw std::runtime_error("Undeclared channel in recording");
+        }
+        RecordChannel& channel = segment.channels[id];
+        record.channel = segment.ids[id];
+
+        segment.last_received.ns += unzigzag(in.varint());
+        if (segment.tsc)
+        {
+            segment.last_received.tsc += static_cast<uint64_t>(unzigzag(in.varint()));
+        }
+        record.received = segment.last_received;
+
+        if (record.type == RecordType::Book)
+        {
+            BookDelta& delta = record.book;
+            const unsigned char flags = in.byte();
+            delta.snapshot = (flags & kBookSnapshot) != 0;
+            channel.change_id += unzigzag(in.varint());
+            delta.change_id = channel.change_id;
+            delta.prev_change_id = delta.snapshot ? 0 :
+                channel.change_id - unzigzag(in.varint());
+
+            read_levels(in, channel, channel.bid_ticks, delta.bids);
+            read_levels(in, channel, channel.ask_ticks, delta.asks);
+
+            if (flags & kBookCheckpoint)
+            {
+                // right after a seek they start the books, as snapshots
+                if (segment.checkpoints)
+                {
+                    return true;
+                }
+                if (!_pass_checkpoints)
+                {
+                    continue;
+                }
+                record.checkpoint = true;
+                return true;
+            }
+        }
+        else if (record.type == RecordType::Json)
+        {
+            record.json_length = in.varint();
+            record.json = in.bytes(record.json_length);
+        }
+        else
+        {
+            throw std::runtime_error("Invalid record type");
+        }
+        segment.checkpoints = false;
+        return true;
+    }
+}
+
+void RecordReader::seek(int64_t ns)
+{
+    for (auto& segment : _segments)
+    {
+        this->seek(*segment, ns);
+    }
+    if (_merging)
+    {
+        _refill = _segments.size();
+        for (auto& segment : _segments)
+        {
+            segment->ready = this->read(*segment, segment->record);
+        }
+    }
+}
+
+void RecordReader::seek(Segment& segment, int64_t ns)
+{
+    if (segment.index == nullptr)
+    {
+        throw std::runtime_error("Recording has no index to seek with");
+    }
+
+    // the last block starting at or before the time
+    const IndexEntry* end = segment.index + segment.index_size;
+    const IndexEntry* entry = std::upper_bound(segment.index, end, ns,
+        [](int64_t t, const IndexEntry& e) { return t < e.ns; });
+    const int64_t offset = (entry == segment.index) ? kHeaderSize : (entry - 1)->offset;
+    if ((offset < static_cast<int64_t>(kHeaderSize)) || (offset > segment.data_end - segment.begin))
+    {
+        throw std::runtime_error("Invalid recording index");
+    }
+
+    segment.data = segment.begin + offset;
+    segment.pos = nullptr;
+    segment.end = nullptr;
+    segment.checkpoints = true;
+}
+
+void RecordReader::seek_change_id(int64_t change_id)
+{
+    // blocks before the first book record have no change id
+    for (auto& segment : _segments)
+    {
+        const IndexEntry* end = segment->index + segment->index_size;
+        const IndexEntry* begin = segment->index;
+        while ((begin != end) && (begin->change_id == 0))
+        {
+            begin++;
+        }
+        if (begin == end)
+        {
+            continue;
+        }
+
+        const IndexEntry* entry = std::upper_bound(begin, end, static_cast<int64_t>(change_id),
+            [](int64_t id, const IndexEntry& e) { return id < e.change_id; });
+        this->seek((entry == begin) ? begin->ns : (entry - 1)->ns);
+        return;
+    }
+    throw std::runtime_error("Recording has no index of change ids");
+}
+
+const std::string& RecordReader::channel_name(int id) const
+{
+    return _channels.at(id).name;
+}
+
+double RecordReader::tick_size(int id) const
+{
+    return _channels.at(id).tick_size;
+}
+
+
+// ---------------------------------------------------------------
+// Segments
+// ---------------------------------------------------------------
+
+std::string segment_name(const std::string& fname, const std::string& channel)
+{
+    std::string name = fname + "." + channel;
+    std::replace_if(name.begin() + fname.size(), name.end(),
+        [](char c) { return (c == '/') || (c == '\\') || (c == ':'); }, '_');
+    return name;
+}
+
+void write_segment_list(const std::string& fname, const std::vector<std::string>& segments)
+{
+    std::string list = std::string(kSegmentList) + "\n";
+    for (const std::string& segment : segments)
+    {
+        const size_t slash = segment.find_last_of("/\\");
+        list += ((slash == std::string::npos) ? segment : segment.substr(slash + 1)) + "\n";
+    }
+
+    const int fd = open_output(fname, false);
+    const bool written = (fd >= 0) && write_output(fd, list.data(), list.size());
+    if (fd >= 0)
+    {
+        close_output(fd);
+    }
+    if (!written)
+    {
+        throw std::runtime_error("Could not write " + fname);
+    }
+}
+
+// ---------------------------------------------------------------
+// DecodedRecording
+// ---------------------------------------------------------------
+
+DecodedRecording::DecodedRecording(const std::string& fname)
+{
+    RecordReader reader(fname);
+    reader.pass_checkpoints(true);
+    Record record;
+    while (reader.next(record))
+    {
+        if (record.type == RecordType::Json)
+        {
+            _json.append(record.json, record.json_length);
+        }
+        _records.push_back(record);
+    }
+
+    // the texts only stay put once all are in
+    size_t offset = 0;
+    for (Record& decoded : _records)
+    {
+        if (decoded.type == RecordType::Json)
+        {
+            decoded.json = _json.data() + offset;
+            offset += decoded.json_length;
+        }
+    }
+
+    _channels.resize(reader.channels());
+    for (size_t i = 0; i < _channels.size(); i++)
+    {
+        _channels[i].name = reader.channel_name(static_cast<int>(i));
+        _channels[i].tick_size = reader.tick_size(static_cast<int>(i));
+    }
+}
+
+const std::string& DecodedRecording::channel_name(int id) const
+{
+    return _channels.at(id).name;
+}
+
+double DecodedRecording::tick_size(int id) const
+{
+    return _channels.at(id).tick_size;
+}
\ No newline at end of file
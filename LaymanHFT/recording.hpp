@@ -0,0 +1,313 @@
+#pragma once
+#include "book.hpp"
+#include "lz4_block.hpp"
+#include "mapped_file.hpp"
+#include "timestamp.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Binary recordings of subscription notifications.
+//
+// A file starts with an 8 byte magic, a 4 byte version and 4 bytes of flags
+// (1 = time stamp counters are recorded), followed by blocks: raw size and
+// stored size (both uint32), then the data, LZ4
+// compressed unless both sizes are equal. Blocks hold whole records, made
+// of a type byte and their fields. Channels are declared by a
+// record before their first use, and referred to by id afterwards.
+// Integers are LEB128 varints, zigzag-encoded when signed. Change ids are
+// stored as differences from the previous ones on the channel, and prices
+// as tick differences from the previous level of the same side; prices off
+// the tick grid and fractional quantities fall back to raw doubles, so
+// nothing is lost. Notifications carry their receive time, as differences
+// from the previous record.
+//
+// Every block decodes on its own: the differences start over from 0, and
+// the block opens with the channels declared again and a checkpoint of
+// each book known in full, a snapshot of it as of the previous record.
+// Readers skip both, except for the checkpoints of the block a seek lands
+// in, which start the books, and the checkpoints readers ask for to
+// restart books that went stale on a gap.
+//
+//  Channel:    id, name length, name, tick size (double)
+//  Book:       channel, time, flags (1 = snapshot, 2 = checkpoint),
+//              change id delta, [change_id - prev_change_id unless snapshot],
+//              bid count, bids, ask count, asks
+//              level = action, price, quantity
+//  Json:       channel, time, length, text of the notification data
+//  time:       monotonic ns delta, [time stamp counter delta]
+//
+// <file>.idx indexes the blocks, for seeking: an 8 byte magic, then for each
+// block the time of its first record, the change id of its first book
+// record (0 if none) and its offset in the file, all int64.
+//
+// A block with both sizes 0 is empty; flushes of O_DIRECT recordings pad
+// the file with zeros, which read as such until written over. A recorder
+// that is killed leaves its last block cut short, and possibly index
+// entries past the end of the file; readers take the recording as ending
+// before them.
+//
+// A recording can also be split into segments, one file per channel. It is
+// then a text file listing them, a "LHFTSEG" line followed by their names
+// relative to its directory, and reads as their records merged by time.
+
+enum class RecordType : unsigned char
+{
+    Channel = 1,
+    Book = 2,
+    Json = 3
+};
+
+
+struct Record
+{
+    RecordType type;
+    int channel;
+    Timestamp received;         // tsc left at 0 unless recorded
+    BookDelta book;             // Book records, vectors reused
+    bool checkpoint;            // Book records: a snapshot of the book as it
+                                // stood, not a notification
+    const char* json;           // Json records, not null-terminated, valid
+    size_t json_length;         // until the next record is read
+};
+
+
+// Encoding state of a channel, mirrored by the reader
+struct RecordChannel
+{
+    std::string name;
+    double tick_size = 0;
+    double ticks_per_unit = 0;
+    int64_t change_id = 0;
+    int64_t bid_ticks = 0;      // last price written on each side
+    int64_t ask_ticks = 0;
+};
+
+
+// Encodes records into the current buffer; full buffers are handed to a
+// background thread which compresses and writes them, so the caller never
+// waits on the disk unless that thread falls a whole buffer behind.
+class RecordWriter
+{
+public:
+    struct Stats
+    {
+        size_t blocks = 0;
+        uint64_t raw_bytes = 0;
+        uint64_t stored_bytes = 0;
+        size_t stalls = 0;                      // times the writer fell behind
+        std::chrono::nanoseconds stall_time{ 0 };
+    };
+
+    RecordWriter(
+        const std::string&,         // file name
+        bool direct = false,        // O_DIRECT writes, where supported
+        bool tsc = false            // record time stamp counters too
+    );
+    ~RecordWriter();
+
+    // Declares a channel whose prices are multiples of the tick size
+    void channel(
+        int,                        // channel id
+        const std::string&,         // name
+        double                      // tick size
+    );
+
+    void write(
+        int,                        // channel id
+        const Timestamp&,           // received
+        const BookDelta&
+    );
+
+    void write(
+        int,                        // channel id
+        const Timestamp&,           // received
+        const char*,                // json text
+        size_t                      // length
+    );
+
+    // Hands over the current block, however small, and has the background
+    // thread write out everything staged, so that what was recorded so far
+    // is in the file and readable
+    void flush();
+
+    Stats stats();
+
+private:
+    static const size_t kBufferSize = 1 << 20;  // raw size of a block
+    static const size_t kAlignment = 4096;      // of the file writes
+    static const size_t kStagingSize = 4 << 20;
+
+    // Books of the book channels, for the checkpoints
+    struct CheckpointBook
+    {
+        bool valid = false;         // from a snapshot, without gaps since
+        int64_t change_id = 0;
+        Bids bids;
+        Asks asks;
+    };
+
+    std::vector<RecordChannel> _channels;
+    std::vector<std::unique_ptr<CheckpointBook>> _books;    // by channel id
+
+    // encoding side
+    std::vector<char> _buffer;
+    size_t _size;
+    bool _tsc;
+    Timestamp _last_received;       // restarts at 0 with each block
+    Timestamp _latest;              // time of the last record
+    int64_t _block_ns;              // first time and change id in the block
+    int64_t _block_change_id;
+
+    // handed over to the background thread
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::condition_variable _done;
+    std::vector<char> _full;
+    size_t _full_size;
+    int64_t _full_ns;
+    int64_t _full_change_id;
+    bool _flush;
+    bool _closing;
+    std::string _error;
+    Stats _stats;
+
+    // background thread only
+    int _fd;
+    int _index_fd;
+    bool _direct;
+    int64_t _offset;                // of the next block in the file
+    int64_t _written;               // bytes written for good, the staging starts there
+    std::vector<int64_t> _unindexed;    // blocks not in the file yet: time,
+                                        // change id, offset and end of each
+    Lz4Compressor _compressor;
+    std::vector<char> _compressed;
+    std::unique_ptr<char[]> _staging_memory;
+    char* _staging;                 // aligned
+    size_t _staged;
+    std::thread _thread;
+
+    // room for at least n more bytes
+    char* reserve(size_t n);
+    char* put_received(char*, const Timestamp&);
+    char* put_channel(char*, int);
+    void begin_block();
+    void write_checkpoint(int);
+    void hand_over();
+    void write_blocks();
+    size_t write_block(const char*, size_t);    // returns the stored size
+    void stage(const char*, size_t);
+    void write_staged(bool all);
+    void write_tail();
+    void write_index(int64_t);      // entries of the blocks ending by then
+};
+
+
+// Reads a recording, or the segments it lists merged by time. Channel ids
+// are the reader's own, numbered in the order the channels appear.
+class RecordReader
+{
+public:
+    explicit RecordReader(const std::string&);     // file name, memory mapped
+    RecordReader(const char*, size_t);              // recording in memory
+
+    // false at the end of the recording, or where it was cut short;
+    // throws if it is corrupt
+    bool next(Record&);
+
+    // Carries on from the last checkpoint at or before the time, found with
+    // the index, so that books start from the checkpoint snapshots; throws
+    // if there is no index
+    void seek(int64_t);             // monotonic ns
+
+    // same, at the checkpoint before the change id of the first book channel
+    void seek_change_id(int64_t);
+
+    // Passes on the checkpoints of every block too, flagged as such, for
+    // books to restart from after a gap
+    void pass_checkpoints(bool pass) { _pass_checkpoints = pass; }
+
+    const std::string& channel_name(int) const;
+    double tick_size(int) const;
+    size_t channels() const { return _channels.size(); }
+
+private:
+    struct IndexEntry
+    {
+        int64_t ns;
+        int64_t change_id;
+        int64_t offset;
+    };
+
+    // a recording file and its decoding state
+    struct Segment
+    {
+        std::unique_ptr<MappedFile> file;
+        std::unique_ptr<MappedFile> index_file;
+        const IndexEntry* index = nullptr;
+        size_t index_size = 0;
+        const char* begin = nullptr;    // of the file
+        const char* data = nullptr;     // blocks still to read
+        const char* data_end = nullptr;
+        std::vector<char> block;        // decompressed block
+        const unsigned char* pos = nullptr;     // records of the current block
+        const unsigned char* end = nullptr;
+        std::vector<RecordChannel> channels;
+        std::vector<int> ids;           // reader channel id of each channel
+        bool tsc = false;
+        bool checkpoints = false;       // passed on, right after a seek
+        Timestamp last_received;
+        Record record;                  // next one, when merging
+        bool ready = false;
+    };
+
+    std::vector<std::unique_ptr<Segment>> _segments;
+    std::vector<RecordChannel> _channels;
+    bool _merging;                  // records of all the segments are read ahead
+    bool _pass_checkpoints;
+    size_t _refill;                 // segment whose record was handed out
+
+    void open(Segment&, const char*, size_t);
+    void open_index(Segment&, const std::string&);
+    bool next_block(Segment&);
+    bool read(Segment&, Record&);
+    void seek(Segment&, int64_t);
+};
+
+
+// Names of the segments of a split recording, and the list of them
+std::string segment_name(
+    const std::string&,         // recording file name
+    const std::string&          // channel
+);
+
+void write_segment_list(
+    const std::string&,         // recording file name
+    const std::vector<std::string>& // segment file names
+);
+
+
+// A whole recording decoded in memory, to be replayed many times over
+// without decoding it again. Read-only once built, so any number of
+// threads can share it. The checkpoints are kept, flagged.
+class DecodedRecording
+{
+public:
+    explicit DecodedRecording(const std::string&);     // file name
+
+    const std::vector<Record>& records() const { return _records; }
+    const std::string& channel_name(int) const;
+    double tick_size(int) const;
+
+private:
+    std::vector<Record> _records;
+    std::string _json;              // texts of the Json records, in order
+    std::vector<RecordChannel> _channels;
+};
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include "replay.hpp"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+
+
+Replay::Replay(const std::string& fname, double speed, double start) :
+    _reader(new RecordReader(fname)),
+    _position(0),
+    _speed(speed),
+    _first_ns(0),
+    _started(std::chrono::steady_clock::now()),
+    _finished(_started),
+    _running(false)
+{
+    _reader->pass_checkpoints(true);
+
+    this->read_ahead();
+    if (start > 0)
+    {
+        // from the checkpoint before, where the books can start; the reader
+        // does not declare the channels read so far again, so they are kept
+        const int64_t ns = _now.ns + static_cast<int64_t>(start * 1e9);
+        _ahead.erase(std::remove_if(_ahead.begin(), _ahead.end(),
+            [](const Record& record) { return record.type != RecordType::Channel; }), _ahead.end());
+        _reader->seek(ns);
+        this->read_ahead();
+    }
+    _first_ns = _now.ns;
+}
+
+Replay::Replay(std::shared_ptr<const DecodedRecording> recording, double speed, double start) :
+    _decoded(std::move(recording)),
+    _position(0),
+    _speed(speed),
+    _first_ns(0),
+    _started(std::chrono::steady_clock::now()),
+    _finished(_started),
+    _running(false)
+{
+    const std::vector<Record>& records = _decoded->records();
+    const auto first = std::find_if(records.begin(), records.end(),
+        [](const Record& record) { return (record.type != RecordType::Channel) && !record.checkpoint; });
+    if (first != records.end())
+    {
+        _now = first->received;
+    }
+    if (start > 0)
+    {
+        // from the first checkpoint at or after it, as snapshots that start
+        // the books, with the channels declared before it ahead
+        const int64_t ns = _now.ns + static_cast<int64_t>(start * 1e9);
+        auto from = std::find_if(records.begin(), records.end(),
+            [ns](const Record& record) { return record.checkpoint && (record.received.ns >= ns); });
+        if (from == records.end())
+        {
+            throw std::runtime_error("No checkpoint in the recording to replay from");
+        }
+        std::copy_if(records.begin(), from, std::back_inserter(_ahead),
+            [](const Record& record) { return record.type == RecordType::Channel; });
+        _now = from->received;
+        for (; (from != records.end()) && from->checkpoint; ++from)
+        {
+            _ahead.push_back(*from);
+            _ahead.back().checkpoint = false;
+        }
+        _position = static_cast<size_t>(from - records.begin());
+    }
+    _first_ns = _now.ns;
+}
+
+// Reads up to the first notification, whose receive time starts the clock
+// for requests sent before it; the records read are handed out first
+void Replay::read_ahead()
+{
+    Record record;
+    while (_reader->next(record))
+    {
+        _ahead.push_back(record);
+        if ((record.type != RecordType::Channel) && !record.checkpoint)
+        {
+            _now = record.received;
+            break;
+        }
+    }
+}
+
+const Record* Replay::read()
+{
+    if (!_ahead.empty())
+    {
+        _record = std::move(_ahead.front());
+        _ahead.pop_front();
+        return &_record;
+    }
+    if (_decoded)
+    {
+        const std::vector<Record>& records = _decoded->records();
+        return (_position < records.size()) ? &records[_position++] : nullptr;
+    }
+    return _reader->next(_record) ? &_record : nullptr;
+}
+
+const Record* Replay::next()
+{
+    if (!_running)
+    {
+        _running = true;
+        _started = std::chrono::steady_clock::now();
+    }
+
+    const Record* record = this->read();
+    if (record == nullptr)
+    {
+        _finished = std::chrono::steady_clock::now();
+        _running = false;
+        return nullptr;
+    }
+    if ((record->type == RecordType::Channel) || record->checkpoint)
+    {
+        if (_observer)
+        {
+            _observer(*record);
+        }
+        return record;
+    }
+
+    _now = record->received;
+    _stats.notifications++;
+    if (record->type == RecordType::Book)
+    {
+        _stats.book_updates++;
+    }
+
+    if (_speed > 0)
+    {
+        const auto due = _started + std::chrono::nanoseconds(
+            static_cast<int64_t>((_now.ns - _first_ns) / _speed));
+        const auto spin = std::chrono::microseconds(kSpinMicroseconds);
+        if (due - std::chrono::steady_clock::now() > spin)
+        {
+            std::this_thread::sleep_until(due - spin);
+        }
+        while (std::chrono::steady_clock::now() < due)
+        {
+        }
+    }
+
+    if (_observer)
+    {
+        _observer(*record);
+    }
+    return record;
+}
+
+void Replay::capture(const std::string& msg)
+{
+    _stats.sent++;
+    if (_sink)
+    {
+        _sink(msg);
+    }
+    else if (_held.size() < kHeldMessages)
+    {
+        _held.push_back(msg);
+    }
+}
+
+void Replay::capture_with(std::function<void(const std::string&)> sink)
+{
+    _sink = std::move(sink);
+    if (_sink)
+    {
+        for (const std::string& msg : _held)
+        {
+            _sink(msg);
+        }
+    }
+    _held.clear();
+}
+
+void Replay::observe(std::function<void(const Record&)> observer)
+{
+    _observer = std::move(observer);
+}
+
+void Replay::inject(const std::string& msg)
+{
+    _inbox.push_back(msg);
+}
+
+bool Replay::injected(std::string& msg)
+{
+    if (_inbox.empty())
+    {
+        return false;
+    }
+    msg.swap(_inbox.front());
+    _inbox.pop_front();
+    return true;
+}
+
+Replay::Stats Replay::stats() const
+{
+    Stats stats = _stats;
+    stats.recorded_ns = _now.ns - _first_ns;
+    stats.elapsed = (_running ? std::chrono::steady_clock::now() : _finished) - _started;
+    return stats;
+}
\ No newline at end of file
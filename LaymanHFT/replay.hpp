@@ -0,0 +1,103 @@
+#pragma once
+#include "recording.hpp"
+#include "timestamp.hpp"
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Source of a replayed session: the notifications of a memory-mapped
+// recording, or of one decoded beforehand and shared, in order, optionally
+// paced by their receive times. Messages the session sends are captured
+// instead of going out. A simulated exchange can watch both and inject its
+// answers, which the session handles after the record in hand.
+class Replay
+{
+public:
+    struct Stats
+    {
+        size_t notifications = 0;
+        size_t book_updates = 0;
+        size_t sent = 0;
+        int64_t recorded_ns = 0;                // span of the receive times
+        std::chrono::nanoseconds elapsed{ 0 };  // taken to replay it
+    };
+
+    Replay(
+        const std::string&,         // recording
+        double,                     // speed against the recorded times, 0 for as fast as possible
+        double = 0                  // seconds into the recording to start from, with its index
+    );
+
+    Replay(
+        std::shared_ptr<const DecodedRecording>,
+        double,                     // speed
+        double = 0                  // seconds into the recording, from the first checkpoint after
+    );
+
+    // Next record, once it is due at the replay speed; null at the end.
+    // Valid until the next call. The checkpoints of the recording come
+    // too, flagged, for simulated exchanges to restart stale books from;
+    // they are not notifications.
+    const Record* next();
+
+    // receive time of the last notification read, the first one before that
+    const Timestamp& now() const { return _now; }
+
+    const std::string& channel_name(int id) const
+    {
+        return _decoded ? _decoded->channel_name(id) : _reader->channel_name(id);
+    }
+    double tick_size(int id) const
+    {
+        return _decoded ? _decoded->tick_size(id) : _reader->tick_size(id);
+    }
+
+    void capture(const std::string&);
+
+    // Passes the captured messages on, e.g. to a simulated exchange.
+    // Messages sent before are held for it, up to kHeldMessages.
+    void capture_with(std::function<void(const std::string&)>);
+
+    // passes every record on as it is read, before the session gets it
+    void observe(std::function<void(const Record&)>);
+
+    // queues a message for the session, as if received
+    void inject(const std::string&);
+
+    // next injected message, false if there is none
+    bool injected(std::string&);
+
+    Stats stats() const;
+
+private:
+    // spins rather than sleeps when a record is due within this
+    static const int kSpinMicroseconds = 200;
+    static const size_t kHeldMessages = 1024;
+
+    // either source
+    std::unique_ptr<RecordReader> _reader;
+    Record _record;
+    std::deque<Record> _ahead;          // read before the replay, handed out first
+    std::shared_ptr<const DecodedRecording> _decoded;
+    size_t _position;
+
+    double _speed;
+    Timestamp _now;
+    int64_t _first_ns;
+    std::chrono::steady_clock::time_point _started;
+    std::chrono::steady_clock::time_point _finished;
+    bool _running;
+    std::function<void(const std::string&)> _sink;
+    std::vector<std::string> _held;     // captured while there was no sink
+    std::function<void(const Record&)> _observer;
+    std::deque<std::string> _inbox;
+    Stats _stats;
+
+    const Record* read();
+    void read_ahead();
+};
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "request.hpp"
+#include <cassert>
+#include <cstring>
+
+
+namespace
+{
+    const char* const kMethodNames[] = {
+        "",
+        "public/auth",
+        "public/get_order_book",
+        "public/get_time",
+        "public/set_heartbeat",
+        "public/subscribe",
+        "public/test",
+        "private/buy",
+        "private/cancel",
+        "private/edit",
+        "private/get_open_orders_by_instrument",
+        "private/get_position",
+        "private/sell"
+    };
+
+    static_assert(
+        sizeof(kMethodNames) / sizeof(kMethodNames[0]) == static_cast<size_t>(Method::Count),
+        "Missing method names");
+}
+
+
+const char* method_name(Method method)
+{
+    return kMethodNames[static_cast<size_t>(method)];
+}
+
+Method method_from_name(const std::string& name)
+{
+    for (size_t i = 1; i < static_cast<size_t>(Method::Count); ++i)
+    {
+        if (name == kMethodNames[i])
+        {
+            return static_cast<Method>(i);
+        }
+    }
+    return Method::Other;
+}
+
+
+Notification notification_from_name(const char* name, size_t length)
+{
+    // the lengths alone tell them apart
+    if ((length == 12) && (std::memcmp(name, "subscription", 12) == 0))
+    {
+        return Notification::Subscription;
+    }
+    if ((length == 9) && (std::memcmp(name, "heartbeat", 9) == 0))
+    {
+        return Notification::Heartbeat;
+    }
+    return Notification::Other;
+}
+
+
+const char* Request::name() const
+{
+    return (method == Method::Other) ? other_method.c_str() : method_name(method);
+}
+
+
+RequestTable::RequestTable() :
+    _slots(kCapacity),
+    _next_id(1),
+    _oldest_id(1)
+{
+}
+
+Request& RequestTable::add(Method method)
+{
+    assert(!this->full());
+
+    const int64_t id = _next_id++;
+    Request& request = _slots[id & (kCapacity - 1)];
+    request.id = id;
+    request.method = method;
+    request.other_method.clear();
+    request.order_id.clear();
+    request.amount = 0;
+    request.price = 0;
+    return request;
+}
+
+Request* RequestTable::find(int64_t id)
+{
+    Request& request = _slots[id & (kCapacity - 1)];
+    return (id > 0 && request.id == id) ? &request : nullptr;
+}
+
+void RequestTable::release(int64_t id)
+{
+    Request* request = this->find(id);
+    if (request != nullptr)
+    {
+        request->id = 0;
+    }
+}
+
+Request* RequestTable::oldest()
+{
+    while (_oldest_id < _next_id)
+    {
+        Request& request = _slots[_oldest_id & (kCapacity - 1)];
+        if (request.id == _oldest_id)
+        {
+            return &request;
+        }
+        ++_oldest_id;
+    }
+    return nullptr;
+}
+
+bool RequestTable::full()
+{
+    this->oldest();
+    return _next_id - _oldest_id >= static_cast<int64_t>(kCapacity);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// JSON-RPC methods the sessions know about, anything else is Other
+enum class Method : unsigned char
+{
+    Other = 0,
+    PublicAuth,
+    PublicGetOrderBook,
+    PublicGetTime,
+    PublicSetHeartbeat,
+    PublicSubscribe,
+    PublicTest,
+    PrivateBuy,
+    PrivateCancel,
+    PrivateEdit,
+    PrivateGetOpenOrdersByInstrument,
+    PrivateGetPosition,
+    PrivateSell,
+    Count
+};
+
+const char* method_name(Method);                // "" for Method::Other
+Method method_from_name(const std::string&);
+
+
+// Methods of the notifications sent by the server
+enum class Notification : unsigned char
+{
+    Other = 0,
+    Subscription,
+    Heartbeat
+};
+
+Notification notification_from_name(const char*, size_t);
+
+
+// In-flight request, with the fields the response handlers need
+struct Request
+{
+    int64_t id = 0;                 // 0 while the slot is free
+    Method method = Method::Other;
+    std::string other_method;       // name, only for Method::Other
+    std::string order_id;
+    double amount = 0;
+    double price = 0;
+    std::chrono::steady_clock::time_point sent;
+
+    const char* name() const;
+};
+
+
+// Fixed-capacity table of in-flight requests, indexed by their (increasing)
+// integer id modulo the capacity.
+class RequestTable
+{
+public:
+    static const size_t kCapacity = 1024;   // power of 2
+
+    RequestTable();
+
+    // Takes the slot of the next id. The table must not be full.
+    Request& add(Method);
+
+    // nullptr if the id is unknown or already released
+    Request* find(int64_t);
+
+    // No-op if the slot was already reused by another request
+    void release(int64_t);
+
+    // Oldest request still in flight, or nullptr
+    Request* oldest();
+
+    bool full();
+
+private:
+    std::vector<Request> _slots;
+    int64_t _next_id;
+    int64_t _oldest_id;     // every request before it was released
+};
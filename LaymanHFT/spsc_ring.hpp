@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+
+// Bounded queue between exactly one producer and one consumer thread.
+// Slots are constructed once and reused, so items holding buffers keep
+// their capacity from one message to the next. The producer fills the slot
+// returned by claim() and makes it visible with publish(); the consumer
+// reads front() and hands it back with pop().
+template <typename T, size_t Capacity>
+class SpscRing
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    static const size_t kCacheLine = 64;
+
+    SpscRing() : _slots(new T[Capacity]), _head(0), _cached_tail(0), _tail(0), _cached_head(0) {}
+
+    // producer: next free slot, nullptr when full
+    T* claim()
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _cached_head == Capacity)
+        {
+            _cached_head = _head.load(std::memory_order_acquire);
+            if (tail - _cached_head == Capacity)
+            {
+                return nullptr;
+            }
+        }
+        return &_slots[tail & (Capacity - 1)];
+    }
+
+    void publish()
+    {
+        _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // consumer: oldest published slot, nullptr when empty
+    T* front()
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _cached_tail)
+        {
+            _cached_tail = _tail.load(std::memory_order_acquire);
+            if (head == _cached_tail)
+            {
+                return nullptr;
+            }
+        }
+        return &_slots[head & (Capacity - 1)];
+    }
+
+    void pop()
+    {
+        _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    std::unique_ptr<T[]> _slots;
+
+    // each index on its own cache line, next to the copy of the other index
+    // its owner last saw, so the threads only share a line when they have to
+    alignas(kCacheLine) std::atomic<size_t> _head;     // written by the consumer
+    size_t _cached_tail;
+    alignas(kCacheLine) std::atomic<size_t> _tail;     // written by the producer
+    size_t _cached_head;
+    char _pad[kCacheLine - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+};
\ No newline at end of file
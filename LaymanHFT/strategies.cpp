@@ -1,7 +1,8 @@
 #include "strategies.hpp"
 
-#include <boost/algorithm/clamp.hpp>
+#include <algorithm>
 #include <iostream>
+#include <cstring>
 #include <chrono>
 
 
@@ -13,18 +14,32 @@ SimpleMM::SimpleMM(
     const Strategy_Params& params
 ) :
     DeribitSession(settings),
-    kMinDepth(params.min_depth),
-    kMidDepth(params.mid_depth),
-    kMaxDepth(params.max_depth),
-    kOrderAmount(params.order_amount),
-    kMaxPositionUSD(params.max_position_usd),
+    kDepths{ params.min_depth, params.mid_depth, params.max_depth },
     _instrument(params.instrument),
     _book_channel("book." + _instrument + "." + params.frequency),
-    _changes_channel("user.changes." + _instrument + "." + params.frequency)
+    _changes_channel("user.changes." + _instrument + "." + params.frequency),
+    _orders(2 * static_cast<size_t>(std::max(params.levels, 0))),
+    _buyer(_orders, 0, params.levels, _instrument, kDepths, params.level_spacing,
+        params.order_amount, params.max_position_usd),
+    _seller(_orders, params.levels, params.levels, _instrument, kDepths, params.level_spacing,
+        params.order_amount, params.max_position_usd),
+    book(params.tick_size)
 {
+    if ((kDepths[0] > kDepths[1]) || (kDepths[1] > kDepths[2]))
+    {
+        throw std::runtime_error("Depths must satisfy min_depth <= mid_depth <= max_depth");
+    }
+    if ((params.levels < 1) || (params.level_spacing < 0))
+    {
+        throw std::runtime_error("Needs at least one level, and a level spacing >= 0");
+    }
+
     _position_usd = NAN;
+    _resync_pending = false;
+    _reconciling = 0;
+    _reconcile_pending = false;
 
-    this->send("private/get_position", { {"instrument_name", _instrument } });
+    this->reconcile();
 
     // Requesting time from the API platform
     this->send("public/get_time");
@@ -32,26 +47,23 @@ SimpleMM::SimpleMM(
     // setting heartbeat to check life
     this->send("public/set_heartbeat", { {"interval", "10"} });
 
+    // book updates are decoded straight into the book
+    this->enable_book_deltas();
+
     // subscribing channel with book information
     this->subscribe({ _book_channel, _changes_channel });
+    _book_handle = this->channel_handle(_book_channel);
+    _changes_handle = this->channel_handle(_changes_channel);
 }
 
 void SimpleMM::on_notification(
-    const std::string& method,
+    Notification notification,
     const rapidjson::Value& params
 )
 {
-    if (method == "subscription")
+    if (notification == Notification::Heartbeat)
     {
-        const std::string& channel = params["channel"].GetString();
-        auto& data = params["data"];
-
-        this->on_subscription_notification(channel, data);
-    }
-    else if (method == "heartbeat")
-    {
-        const std::string& type = params["type"].GetString();
-        if (type == "test_request")
+        if (std::strcmp(params["type"].GetString(), "test_request") == 0)
         {
             this->send("public/test");
             this->send("public/get_time");
@@ -64,213 +76,112 @@ void SimpleMM::on_notification(
 }
 
 void SimpleMM::on_subscription_notification(
-    const std::string& channel,
+    int channel,
     const rapidjson::Value& data
 )
 {
     // -------------------------------------------------------
     // Book updates
     // -------------------------------------------------------
-    if (channel == _book_channel)
+    if (channel == _book_handle)
     {
         book.update(data);
-
-        if (std::isnan(_position_usd))
-        {
-            return;
-        }
-
-        // ---------------------------------------------------
-        // BUY ORDERS
-        // ---------------------------------------------------
-
-        if (buy_order.id.empty())
-        {
-            double buy_price = book.bids.price_depth(kMidDepth);
-
-            if ((_position_usd < kMaxPositionUSD) &&
-                (buy_price > 0) &&
-                (!buy_order.wait))
-            {
-                double buy_qty = boost::algorithm::clamp(
-                    10 * floor(kOrderAmount * (1 - _position_usd / kMaxPositionUSD) / 10),
-                    0, 2 * kOrderAmount
-                );
-
-
-                std::string label = "buy_" + _instrument;
-
-                std::cout << "Sending order to buy at " << buy_price << std::endl;
-
-                this->send("private/buy", {
-                        {"instrument_name", _instrument},
-                        {"amount", buy_qty },
-                        {"type", "limit"},
-                        {"label", label},
-                        {"price", buy_price },
-                        {"post_only", "true"}
-                    });
-
-                buy_order.price = buy_price;
-                buy_order.quantity = buy_qty;
-                buy_order.wait = true;
-            }
-        }
-        else
-        {
-            double buy_price = book.bids.price_depth(kMidDepth, buy_order.price, buy_order.quantity);
-            double min_buy_price = book.bids.price_depth(kMaxDepth, buy_order.price, buy_order.quantity);
-            double max_buy_price = book.bids.price_depth(kMinDepth, buy_order.price, buy_order.quantity);
-
-            if ((buy_order.price > max_buy_price) || (buy_order.price < min_buy_price))
-            {
-                double buy_qty = boost::algorithm::clamp(
-                    10 * floor(kOrderAmount * (1 - _position_usd / kMaxPositionUSD) / 10),
-                    0, 2 * kOrderAmount
-                );
-
-                //std::cout << "Sending request to edit buy order to " << buy_price << std::endl;
-
-                this->send("private/edit", {
-                        {"order_id", buy_order.id },
-                        {"amount", buy_qty},
-                        {"price", buy_price}
-                    });
-
-                buy_order.price = buy_price;
-                buy_order.quantity = buy_qty;
-            }
-        }
-
-        // ---------------------------------------------------
-        // SELL ORDERS
-        // ---------------------------------------------------
-
-        if (sell_order.id.empty())
-        {
-            double sell_price = book.asks.price_depth(kMidDepth);
-
-            if ((_position_usd > -kMaxPositionUSD) &&
-                (sell_price > 0) &&
-                (!sell_order.wait))
-            {
-                double sell_qty = boost::algorithm::clamp(
-                    10 * floor(kOrderAmount * (1 + _position_usd / kMaxPositionUSD) / 10),
-                    0, 2 * kOrderAmount
-                );
-
-
-                std::string label = "sell_" + _instrument;
-
-                std::cout << "Sending order to sell at " << sell_price << std::endl;
-
-                this->send("private/sell", {
-                        {"instrument_name", _instrument},
-                        {"amount", sell_qty },
-                        {"type", "limit"},
-                        {"label", label},
-                        {"price", sell_price },
-                        {"post_only", "true"}
-                    });
-
-                sell_order.price = sell_price;
-                sell_order.quantity = sell_qty;
-                sell_order.wait = true;
-            }
-        }
-        else
-        {
-            double sell_price = book.asks.price_depth(kMidDepth, sell_order.price, sell_order.quantity);
-            double max_sell_price = book.asks.price_depth(kMaxDepth, sell_order.price, sell_order.quantity);
-            double min_sell_price = book.asks.price_depth(kMinDepth, sell_order.price, sell_order.quantity);
-
-            if ((sell_order.price > max_sell_price) || (sell_order.price < min_sell_price))
-            {
-                double sell_qty = boost::algorithm::clamp(
-                    10 * floor(kOrderAmount * (1 + _position_usd / kMaxPositionUSD) / 10),
-                    0, 2 * kOrderAmount
-                );
-
-                // std::cout << "Sending request to edit sell order to " << sell_price << std::endl;
-
-                this->send("private/edit", {
-                        {"order_id", sell_order.id },
-                        {"amount", sell_qty},
-                        {"price", sell_price}
-                    });
-
-                sell_order.price = sell_price;
-                sell_order.quantity = sell_qty;
-            }
-        }
+        this->quote();
     }
     // -------------------------------------------------------
     // Changes updates
     // -------------------------------------------------------
-    else if (channel == _changes_channel)
+    else if (channel == _changes_handle)
     {
         const auto& trades = data["trades"];
 
         for (auto it = trades.Begin(); it != trades.End(); ++it)
         {
             const auto& trade = *it;
-            const std::string& direction = trade["direction"].GetString();
-            const std::string& state = trade["state"].GetString();
+            const char* order_id = trade["order_id"].GetString();
+            const char* direction = trade["direction"].GetString();
+            const char* state = trade["state"].GetString();
             const double& amount = trade["amount"].GetDouble();
 
-            if (state == "filled")
+            const bool filled = std::strcmp(state, "filled") == 0;
+            if (!filled && (std::strcmp(state, "open") != 0))
+            {
+                throw std::runtime_error("Unexpected state.");
+            }
+
+            if (std::strcmp(direction, "buy") == 0)
             {
-                if (direction == "buy")
-                {
-                    std::cout << "Buy order filled" << std::endl;
-                    std::cout << trade << std::endl;
-                    _position_usd += amount;
-                    buy_order.id = "";
-                    buy_order.wait = false;
-                }
-                else if (direction == "sell")
-                {
-                    std::cout << "Sell order filled" << std::endl;
-                    std::cout << trade << std::endl;
-                    _position_usd -= amount;
-                    sell_order.id = "";
-                    sell_order.wait = false;
-                }
-                else
-                {
-                    throw std::runtime_error("Invalid direction.");
-                }
+                _position_usd += _buyer.fill(amount);
             }
-            else if (state == "open")
+            else if (std::strcmp(direction, "sell") == 0)
             {
-                if (direction == "buy")
-                {
-                    std::cout << "Buy order partially filled" << std::endl;
-                    std::cout << trade << std::endl;
-                    _position_usd += amount;
-                }
-                else if (direction == "sell")
-                {
-                    std::cout << "Sell order partially filled" << std::endl;
-                    std::cout << trade << std::endl;
-                    _position_usd -= amount;
-                }
-                else
-                {
-                    throw std::runtime_error("Invalid direction.");
-                }
+                _position_usd += _seller.fill(amount);
             }
             else
             {
-                throw std::runtime_error("Unexpected state.");
+                throw std::runtime_error("Invalid direction.");
+            }
+
+            // not found while the new order is unanswered: its answer has
+            // the filled amount
+            const int slot = _orders.find_order(order_id);
+            if (slot >= 0)
+            {
+                _orders.fill(slot, amount, filled);
             }
+            this->log() << (filled ? "Filled " : "Partially filled ") << direction << " order" << std::endl;
+            this->log() << trade << std::endl;
+        }
+    }
+}
+
+void SimpleMM::on_book_notification(
+    int channel,
+    const BookDelta& delta
+)
+{
+    if (channel == _book_handle)
+    {
+        book.update(delta);
+        this->quote();
+    }
+}
+
+void SimpleMM::quote()
+{
+    if (book.stale())
+    {
+        // no quoting until the book is resynchronized from a snapshot
+        if (!_resync_pending)
+        {
+            this->log() << "Gap in the book sequence, requesting a snapshot." << std::endl;
+            this->send("public/get_order_book", {
+                    {"instrument_name", _instrument},
+                    {"depth", 10000.0}
+                });
+            _resync_pending = true;
         }
+        return;
+    }
+
+    // an order that timed out may still have reached the exchange; not
+    // reconciled from on_timeout, which also runs while reconnecting
+    if (_reconcile_pending && (_reconciling == 0))
+    {
+        this->reconcile();
+    }
+
+    if (std::isnan(_position_usd) || (_reconciling > 0))
+    {
+        return;
     }
+
+    _buyer.quote(*this, book, _position_usd);
+    _seller.quote(*this, book, _position_usd);
 }
 
 void SimpleMM::on_response(
-    const std::string& method,
-    const rapidjson::Value&, //request,
+    const Request& request,
     const rapidjson::Value& result
 )
 {
@@ -279,113 +190,157 @@ void SimpleMM::on_response(
     // private / edit
     // -----------------------------------------------------------
 
-    if (method == "private/edit")
+    if (request.method == Method::PrivateEdit)
     {
+        // unknown once cancelled or found closed meanwhile
         const auto& order = result["order"];
-        const std::string& direction = order["direction"].GetString();
-        const std::string& order_id = order["order_id"].GetString();
-
-        if (direction == "buy")
-        {
-            assert(order_id == buy_order.id);
-            // std::cout << "Received edit buy order confirmation" << std::endl;
-        }
-        else if (direction == "sell")
+        const int slot = _orders.find_order(order["order_id"].GetString());
+        if (slot >= 0)
         {
-            assert(order_id == sell_order.id);
-            // std::cout << "Received edit sell order confirmation" << std::endl;
-        }
-        else
-        {
-            throw std::runtime_error("Invalid direction.");
+            _orders.edited(slot, request.price, request.amount);
+            this->settle(slot, order);
         }
     }
 
     // -----------------------------------------------------------
-    // private / buy
+    // private / buy, private / sell
     // -----------------------------------------------------------
 
-    else if (method == "private/buy")
+    else if ((request.method == Method::PrivateBuy) || (request.method == Method::PrivateSell))
     {
+        // unknown if reconciled meanwhile, which finds the order if open
         const auto& order = result["order"];
-        buy_order.id = order["order_id"].GetString();
-        buy_order.wait = false;
-        std::cout << "Received buy order confirmation." << std::endl;
+        const int slot = _orders.find_request(request.id);
+        if (slot >= 0)
+        {
+            _orders.placed(slot, order["order_id"].GetString(), order["filled_amount"].GetDouble());
+            this->settle(slot, order);
+        }
+        this->log() << "Received " << order["direction"].GetString() << " order confirmation." << std::endl;
     }
 
     // -----------------------------------------------------------
-    // private / sell
+    // private / cancel
     // -----------------------------------------------------------
 
-    else if (method == "private/sell")
+    else if (request.method == Method::PrivateCancel)
     {
-        const auto& order = result["order"];
-        sell_order.id = order["order_id"].GetString();
-        sell_order.wait = false;
-        std::cout << "Received sell order confirmation." << std::endl;
+        const int slot = _orders.find_order(result["order_id"].GetString());
+        if (slot >= 0)
+        {
+            _orders.release(slot);
+        }
     }
 
     // -----------------------------------------------------------
     // private / get_position
     // -----------------------------------------------------------
 
-    else if (method == "private/get_position")
+    else if (request.method == Method::PrivateGetPosition)
     {
         assert(result["instrument_name"].GetString() == _instrument);
         const double& server_position_usd = result["size"].GetDouble();
-        if (std::isnan(_position_usd))
+        if (std::isnan(_position_usd) || (_reconciling > 0))
         {
             _position_usd = server_position_usd;
-            std::cout << "Initial position: " << _position_usd << std::endl;
+            this->log() << "Position: " << _position_usd << std::endl;
         }
         else if (_position_usd != server_position_usd)
         {
             throw std::runtime_error("Position (USD) mismatch");
         }
+
+        if (_reconciling > 0)
+        {
+            _reconciling--;
+        }
+    }
+
+    // -----------------------------------------------------------
+    // private / get_open_orders_by_instrument
+    // -----------------------------------------------------------
+
+    else if (request.method == Method::PrivateGetOpenOrdersByInstrument)
+    {
+        _orders.clear();
+
+        for (auto it = result.Begin(); it != result.End(); ++it)
+        {
+            const auto& order = *it;
+            const char* label = order.HasMember("label") ? order["label"].GetString() : "";
+            const bool buy = (_buyer.label() == label);
+            if (!buy && (_seller.label() != label))
+            {
+                continue;   // not placed by this strategy
+            }
+
+            const char* order_id = order["order_id"].GetString();
+            const double price = order["price"].GetDouble();
+            const double amount = order["amount"].GetDouble();
+            const double filled = order["filled_amount"].GetDouble();
+            if (!(buy ? _buyer.adopt(order_id, price, amount, filled) : _seller.adopt(order_id, price, amount, filled)))
+            {
+                this->log() << "Ignoring extra open order " << order_id << std::endl;
+            }
+        }
+
+        this->log() << "Open orders: buy " << _buyer.open_orders()
+            << ", sell " << _seller.open_orders() << std::endl;
+
+        if (_reconciling > 0)
+        {
+            _reconciling--;
+        }
+    }
+
+    // -----------------------------------------------------------
+    // public / get_order_book
+    // -----------------------------------------------------------
+
+    else if (request.method == Method::PublicGetOrderBook)
+    {
+        book.reset(result);
+        _resync_pending = false;
+        if (book.stale())
+        {
+            this->log() << "Snapshot behind the buffered updates, retrying." << std::endl;
+        }
+        else
+        {
+            this->log() << "Book resynchronized." << std::endl;
+        }
     }
 
     // -----------------------------------------------------------
     // public / get_time
     // -----------------------------------------------------------
 
-    else if (method == "public/get_time")
+    else if (request.method == Method::PublicGetTime)
     {
-        long t_system = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
-        long t_server = result.GetInt64();
-        std::cout << "System time: " << t_system << std::endl;
-        std::cout << "Server time: " << t_server << std::endl;
-        std::cout << std::endl;
+        int64_t t_system = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+        int64_t t_server = result.GetInt64();
+        this->log() << "System time: " << t_system << std::endl;
+        this->log() << "Server time: " << t_server << std::endl;
+        this->log() << std::endl;
     }
 }
 
 void SimpleMM::on_error(
-    const std::string&, // method
-    const rapidjson::Value& request,
+    const Request& request,
     int code,
     const std::string& msg
 )
 {
     if ((code == 11044) || (code == 10010))
     {
-        std::cout << "Received error message: (" << code << ") " << msg << std::endl;
+        this->log() << "Received error message: (" << code << ") " << msg << std::endl;
         // 11044 - Not open order
         // 10010 - Already closed
-        const std::string& order_id = request["order_id"].GetString();
-        // const auto& amount = request["amount"].GetDouble();
-
-        if (order_id == buy_order.id)
-        {
-            buy_order.id = "";
-            buy_order.wait = false;
-            // _position_usd += amount;
-            std::cout << "Closed buy order. Position=" << _position_usd << std::endl;
-        }
-        else if (order_id == sell_order.id)
+        const int slot = _orders.find_order(request.order_id);
+        if (slot >= 0)
         {
-            sell_order.id = "";
-            sell_order.wait = false;
-            // _position_usd -= amount;
-            std::cout << "Closed sell order. Position=" << _position_usd << std::endl;
+            _orders.release(slot);
+            this->log() << "Closed order " << request.order_id << ". Position=" << _position_usd << std::endl;
         }
     }
     else if (code == 13777)
@@ -394,8 +349,76 @@ void SimpleMM::on_error(
     }
     else
     {
-        std::cout << "Received error message: (" << code << ") " << msg << std::endl;
-        std::cout << request << std::endl;
+        this->log() << "Received error message: (" << code << ") " << msg << std::endl;
+        this->log() << request.name() << " " << request.order_id << std::endl;
         throw std::runtime_error("Unexpected error");
     }
 }
+
+void SimpleMM::on_timeout(const Request& request)
+{
+    this->log() << "No response to " << request.name() << std::endl;
+
+    if (request.method == Method::PublicGetOrderBook)
+    {
+        // requested again on the next book update
+        _resync_pending = false;
+    }
+    else if ((request.method == Method::PrivateGetPosition) ||
+        (request.method == Method::PrivateGetOpenOrdersByInstrument))
+    {
+        // quote with what is known rather than not at all
+        if (_reconciling > 0)
+        {
+            _reconciling--;
+        }
+    }
+    else if ((request.method == Method::PrivateBuy) || (request.method == Method::PrivateSell) ||
+        (request.method == Method::PrivateEdit) || (request.method == Method::PrivateCancel))
+    {
+        // whether it went through is unknown, the open orders tell; only
+        // new orders have a slot to free, the others are open until then
+        const int slot = _orders.find_request(request.id);
+        if (slot >= 0)
+        {
+            _orders.release(slot);
+        }
+        _reconcile_pending = true;
+    }
+}
+
+void SimpleMM::settle(int slot, const rapidjson::Value& order)
+{
+    const char* state = order["order_state"].GetString();
+    if (std::strcmp(state, "filled") == 0)
+    {
+        // the fills themselves come with the changes
+        if (!_orders.slot(slot).free())
+        {
+            _orders.fill(slot, 0, true);
+        }
+    }
+    else if (std::strcmp(state, "open") != 0)
+    {
+        _orders.release(slot);     // cancelled or rejected
+    }
+}
+
+void SimpleMM::reconcile()
+{
+    // quoting holds until both are answered
+    _reconciling = 2;
+    _reconcile_pending = false;
+    this->send("private/get_open_orders_by_instrument", { {"instrument_name", _instrument} });
+    this->send("private/get_position", { {"instrument_name", _instrument} });
+}
+
+void SimpleMM::on_reconnect()
+{
+    this->log() << "Reconnected, reconciling orders and position." << std::endl;
+
+    // connection settings do not carry over
+    this->send("public/set_heartbeat", { {"interval", "10"} });
+
+    this->reconcile();
+}
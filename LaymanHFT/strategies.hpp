@@ -1,6 +1,8 @@
 #pragma once
 #include "deribit_session.hpp"
 #include "book.hpp"
+#include "order_manager.hpp"
+#include "quoter.hpp"
 
 
 struct Strategy_Params
@@ -8,8 +10,11 @@ struct Strategy_Params
     double min_depth = 0;
     double mid_depth = 0;
     double max_depth = 0;
+    int levels = 1;             // orders per side
+    double level_spacing = 0;   // depth between them
     double order_amount = 0;
     double max_position_usd = 0;
+    double tick_size = 0.5;
     std::string frequency = "raw";
     std::string instrument = "";
 };
@@ -19,13 +24,29 @@ struct Strategy_Params
 class SimpleMM : public DeribitSession
 {
 private:
-    const double kMinDepth, kMidDepth, kMaxDepth;
-    const double kOrderAmount, kMaxPositionUSD;
+    const double kDepths[3];    // min, mid and max depths
     std::string _instrument;
     std::string _book_channel, _changes_channel;
+    int _book_handle, _changes_handle;
     double _position_usd;
-    Order buy_order, sell_order;
-    Book book;
+    bool _resync_pending;
+    int _reconciling;           // reconciliation answers still to come
+    bool _reconcile_pending;    // an order request went unanswered
+    OrderManager _orders;       // buy levels, then sell levels
+    Quoter<BuySide> _buyer;
+    Quoter<SellSide> _seller;
+    LadderBook book;
+
+    void quote();
+
+    // Settles the slot of an order from its state in an answer
+    void settle(
+        int,                    // slot
+        const rapidjson::Value& // order
+    );
+
+    // Takes the resting orders and the position from the exchange
+    void reconcile();
 
 public:
     //using DeribitSession::run;
@@ -35,25 +56,34 @@ public:
     );
 
     void on_notification(
-        const std::string&,     // method
+        Notification,           // method
         const rapidjson::Value& // params
     );
 
     void on_subscription_notification(
-        const std::string&,     // channel
+        int,                    // channel handle
         const rapidjson::Value& // content
     );
 
+    void on_book_notification(
+        int,                    // channel handle
+        const BookDelta&        // decoded book changes
+    );
+
     void on_response(
-        const std::string&,     // method
-        const rapidjson::Value&,// request
+        const Request&,         // request
         const rapidjson::Value& // response
     );
 
     void on_error(
-        const std::string&,     // mehtod
-        const rapidjson::Value&,// request
+        const Request&,         // request
         int,                    // error code
         const std::string&      // error message
     );
+
+    void on_timeout(
+        const Request&          // request
+    );
+
+    void on_reconnect();
 };
\ No newline at end of file
@@ -0,0 +1,205 @@
+#include "sweep.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+
+namespace
+{
+    // parameters that can be swept, by name
+    struct SweptParam
+    {
+        const char* name;
+        double Strategy_Params::* member;
+    };
+
+    const SweptParam kSweptParams[] =
+    {
+        { "min_depth", &Strategy_Params::min_depth },
+        { "mid_depth", &Strategy_Params::mid_depth },
+        { "max_depth", &Strategy_Params::max_depth },
+        { "level_spacing", &Strategy_Params::level_spacing },
+        { "order_amount", &Strategy_Params::order_amount },
+        { "max_position_usd", &Strategy_Params::max_position_usd },
+    };
+}
+
+
+Sweep::Sweep(const std::string& fname, const API_Settings& settings, unsigned threads) :
+    _recording(std::make_shared<DecodedRecording>(fname)),
+    _settings(settings),
+    _threads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()))
+{
+    // as fast as possible, and wherever the scheduler puts them
+    _settings.replay.clear();
+    _settings.replay_speed = 0;
+    _settings.replay_recording = _recording;
+    _settings.io_core = -1;
+    _settings.strategy_core = -1;
+    _settings.lock_memory = false;
+    _settings.quiet = true;
+}
+
+std::vector<Sweep::Result> Sweep::run(const std::vector<Strategy_Params>& params)
+{
+    std::vector<Result> results(params.size());
+    const size_t workers = std::min<size_t>(_threads, params.size());
+    if (workers == 0)
+    {
+        return results;
+    }
+
+    std::vector<Queue> queues(workers);
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        queues[i % workers].runs.push_back(i);
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t worker = 0; worker < workers; worker++)
+    {
+        threads.emplace_back([this, &queues, &params, &results, worker]()
+            {
+                size_t i;
+                while (take(queues, worker, i))
+                {
+                    results[i] = this->backtest(params[i]);
+                }
+            });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    return results;
+}
+
+bool Sweep::take(std::vector<Queue>& queues, size_t worker, size_t& run)
+{
+    {
+        Queue& own = queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.runs.empty())
+        {
+            run = own.runs.back();
+            own.runs.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t k = 1; k < queues.size(); k++)
+    {
+        Queue& victim = queues[(worker + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.runs.empty())
+        {
+            run = victim.runs.front();
+            victim.runs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+Sweep::Result Sweep::backtest(const Strategy_Params& params) const
+{
+    Result result;
+    result.params = params;
+    try
+    {
+        auto mm = std::make_shared<SimpleMM>(_settings, params);
+        Backtest backtest(*mm->replay(), params.instrument);
+        mm->run();
+        result.report = backtest.report();
+    }
+    catch (const std::exception& e)
+    {
+        result.error = e.what();
+    }
+    return result;
+}
+
+void Sweep::print(const std::vector<Result>& results)
+{
+    std::vector<const Result*> ranked;
+    for (const Result& result : results)
+    {
+        ranked.push_back(&result);
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [](const Result* a, const Result* b)
+        {
+            return a->error.empty() && (!b->error.empty() || (a->report.pnl > b->report.pnl));
+        });
+
+    std::cout << std::setw(10) << "min_depth" << std::setw(10) << "mid_depth" << std::setw(10) << "max_depth"
+        << std::setw(8) << "levels" << std::setw(15) << "level_spacing" << std::setw(10) << "amount" << std::setw(12) << "max_pos_usd"
+        << std::setw(8) << "orders" << std::setw(8) << "fills" << std::setw(8) << "filled%"
+        << std::setw(12) << "volume" << std::setw(12) << "max_pos" << std::setw(12) << "mean_pos"
+        << std::setw(14) << "pnl" << std::endl;
+
+    for (const Result* result : ranked)
+    {
+        const Strategy_Params& p = result->params;
+        std::cout << std::setw(10) << p.min_depth << std::setw(10) << p.mid_depth << std::setw(10) << p.max_depth
+            << std::setw(8) << p.levels << std::setw(15) << p.level_spacing << std::setw(10) << p.order_amount << std::setw(12) << p.max_position_usd;
+        if (!result->error.empty())
+        {
+            std::cout << "  failed: " << result->error << std::endl;
+            continue;
+        }
+
+        const Backtest::Report& r = result->report;
+        std::cout << std::setw(8) << r.orders << std::setw(8) << r.fills
+            << std::setw(8) << std::fixed << std::setprecision(1)
+            << (r.orders > 0 ? 100.0 * r.filled_orders / r.orders : 0) << std::defaultfloat << std::setprecision(6)
+            << std::setw(12) << r.volume << std::setw(12) << r.max_position << std::setw(12) << r.mean_position
+            << std::setw(14) << r.pnl << std::endl;
+    }
+}
+
+std::vector<Strategy_Params> Sweep::grid(const Strategy_Params& base, const std::vector<std::string>& specs)
+{
+    std::vector<Strategy_Params> grid{ base };
+    for (const std::string& spec : specs)
+    {
+        const size_t eq = spec.find('=');
+        const std::string name = spec.substr(0, eq);
+        const SweptParam* param = nullptr;
+        for (const SweptParam& swept : kSweptParams)
+        {
+            if (name == swept.name)
+            {
+                param = &swept;
+            }
+        }
+        if ((eq == std::string::npos) || (param == nullptr))
+        {
+            throw std::runtime_error("Invalid sweep, expected one of min_depth, mid_depth, max_depth, "
+                "level_spacing, order_amount or max_position_usd=v1,v2,...: " + spec);
+        }
+
+        std::vector<double> values;
+        std::istringstream list(spec.substr(eq + 1));
+        std::string value;
+        while (std::getline(list, value, ','))
+        {
+            values.push_back(std::stod(value));
+        }
+
+        std::vector<Strategy_Params> expanded;
+        for (const Strategy_Params& params : grid)
+        {
+            for (double v : values)
+            {
+                expanded.push_back(params);
+                expanded.back().*(param->member) = v;
+            }
+        }
+        grid.swap(expanded);
+    }
+    return grid;
+}
\ No newline at end of file
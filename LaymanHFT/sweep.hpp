@@ -0,0 +1,61 @@
+#pragma once
+#include "backtest.hpp"
+#include "recording.hpp"
+#include "strategies.hpp"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// Backtests of SimpleMM over a grid of parameters, on one recording. The
+// recording is decoded once and shared read-only by the worker threads,
+// each running whole backtests: a worker takes runs from the back of its
+// own queue, and steals from the front of the others' once it runs dry.
+class Sweep
+{
+public:
+    struct Result
+    {
+        Strategy_Params params;
+        Backtest::Report report;
+        std::string error;          // empty unless the run failed
+    };
+
+    Sweep(
+        const std::string&,         // recording
+        const API_Settings&,        // base settings of the sessions
+        unsigned                    // worker threads, 0 for one per core
+    );
+
+    // Runs the backtests, in any order, with quiet sessions; the results
+    // follow the parameters.
+    std::vector<Result> run(const std::vector<Strategy_Params>&);
+
+    // the results ranked by PnL, one line each
+    static void print(const std::vector<Result>&);
+
+    // Parameter grid: the base parameters with each "name=v1,v2,..." swept,
+    // every combination once
+    static std::vector<Strategy_Params> grid(
+        const Strategy_Params&,
+        const std::vector<std::string>&
+    );
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> runs;
+    };
+
+    std::shared_ptr<const DecodedRecording> _recording;
+    API_Settings _settings;
+    unsigned _threads;
+
+    // next run for the worker, false once every queue is empty
+    static bool take(std::vector<Queue>&, size_t, size_t&);
+    Result backtest(const Strategy_Params&) const;
+};
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Reading the time stamp counter is a build option: define LAYMANHFT_TSC
+// on x86 to stamp every frame with it as well
+#ifdef LAYMANHFT_TSC
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#error "LAYMANHFT_TSC needs an x86 target"
+#endif
+#endif
+
+
+// When a frame was received: the monotonic clock in nanoseconds, and the
+// time stamp counter when built with LAYMANHFT_TSC (0 otherwise)
+struct Timestamp
+{
+    int64_t ns = 0;
+    uint64_t tsc = 0;
+};
+
+inline Timestamp timestamp_now()
+{
+    Timestamp t;
+    t.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#ifdef LAYMANHFT_TSC
+    t.tsc = __rdtsc();
+#endif
+    return t;
+}
\ No newline at end of file
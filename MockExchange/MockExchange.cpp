@@ -0,0 +1,52 @@
+#include <iostream>
+#include "mock_server.hpp"
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+int main(int argc, char** argv)
+{
+    // Declare the supported options.
+    po::options_description opts_desc("Allowed options");
+    opts_desc.add_options()
+        ("help",            "Produces help message")
+        ("address",         po::value<std::string>()->default_value(        "127.0.0.1"),       "Address to listen on")
+        ("port",            po::value<unsigned short>()->default_value(     8443),              "Port to listen on")
+        ("cert",            po::value<std::string>()->required(),                               "Server certificate chain (PEM)")
+        ("key",             po::value<std::string>()->required(),                               "Server private key (PEM)")
+        ("replay",          po::value<std::string>()->default_value(        ""),                "Recording whose channels are served")
+        ("replay_speed",    po::value<double>()->default_value(             1),                 "Replay speed against the recorded times, 0 for as fast as possible")
+        ("replay_from",     po::value<double>()->default_value(             0),                 "Seconds into the recording to start from")
+        ("tick_size",       po::value<double>()->default_value(             0.5),               "Tick size of instruments not in the recording")
+        ;
+
+    po::variables_map opts_var_map;
+    po::store(po::parse_command_line(argc, argv, opts_desc), opts_var_map);
+
+    if (opts_var_map.count("help")) {
+        std::cout << opts_desc << "\n";
+        return EXIT_FAILURE;
+    }
+
+    po::notify(opts_var_map);
+
+    // clients do not verify the certificate, a self-signed one will do
+    ssl::context ctx{ ssl::context::tlsv12_server };
+    ctx.use_certificate_chain_file(opts_var_map["cert"].as<std::string>());
+    ctx.use_private_key_file(opts_var_map["key"].as<std::string>(), ssl::context::pem);
+
+    net::io_context ioc;
+    const tcp::endpoint endpoint(
+        net::ip::make_address(opts_var_map["address"].as<std::string>()),
+        opts_var_map["port"].as<unsigned short>());
+
+    MockServer server(ioc, ctx, endpoint,
+        opts_var_map["replay"].as<std::string>(),
+        opts_var_map["replay_speed"].as<double>(),
+        opts_var_map["replay_from"].as<double>(),
+        opts_var_map["tick_size"].as<double>());
+    server.start();
+    ioc.run();
+
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,378 @@
+#include "matching_engine.hpp"
+#include <algorithm>
+
+
+const char* direction_name(Direction direction)
+{
+    return direction == Direction::Buy ? "buy" : "sell";
+}
+
+const char* order_state_name(OrderState state)
+{
+    switch (state)
+    {
+    case OrderState::Open:
+        return "open";
+    case OrderState::Filled:
+        return "filled";
+    default:
+        return "cancelled";
+    }
+}
+
+
+MatchingEngine::MatchingEngine(const std::string& instrument, double tick_size) :
+    _instrument(instrument),
+    _tick_size(tick_size),
+    _change_id(0),
+    _gaps(0),
+    _next_order(1),
+    _next_sequence(1),
+    _next_trade(1)
+{
+}
+
+MockOrder MatchingEngine::submit(
+    const std::string& account,
+    Direction direction,
+    double amount,
+    double price,
+    bool post_only,
+    const std::string& label,
+    std::vector<Fill>& fills)
+{
+    const std::string id = _instrument + "-" + std::to_string(_next_order++);
+    std::unique_ptr<MockOrder>& slot = _orders[id];
+    slot.reset(new MockOrder{ id, account, label, direction, price, amount, 0, post_only,
+        OrderState::Open, _next_sequence++ });
+
+    MockOrder& order = *slot;
+    this->place(order, fills);
+
+    MockOrder result = order;
+    if (order.state != OrderState::Open)
+    {
+        this->close(order, order.state);
+    }
+    return result;
+}
+
+bool MatchingEngine::edit(
+    const std::string& account,
+    const std::string& order_id,
+    double amount,
+    double price,
+    MockOrder& result,
+    std::vector<Fill>& fills)
+{
+    MockOrder* order = this->find(account, order_id);
+    if (order == nullptr)
+    {
+        return false;
+    }
+
+    if (amount <= order->filled)
+    {
+        // nothing left to trade
+        order->amount = amount;
+        result = *order;
+        result.state = OrderState::Filled;
+        this->close(*order, OrderState::Filled);
+        return true;
+    }
+
+    if ((price == order->price) && (amount <= order->amount))
+    {
+        order->amount = amount;
+        result = *order;
+        return true;
+    }
+
+    // to the back of the queue at the new price
+    this->unrest(*order);
+    order->price = price;
+    order->amount = amount;
+    order->sequence = _next_sequence++;
+    this->place(*order, fills);
+
+    result = *order;
+    if (order->state != OrderState::Open)
+    {
+        this->close(*order, order->state);
+    }
+    return true;
+}
+
+bool MatchingEngine::cancel(const std::string& account, const std::string& order_id, MockOrder& result)
+{
+    MockOrder* order = this->find(account, order_id);
+    if (order == nullptr)
+    {
+        return false;
+    }
+
+    result = *order;
+    result.state = OrderState::Cancelled;
+    this->close(*order, OrderState::Cancelled);
+    return true;
+}
+
+void MatchingEngine::on_book(const BookDelta& delta, std::vector<Fill>& fills)
+{
+    const bool stale = _book.stale();
+    _book.update(delta);
+    if (_book.stale())
+    {
+        if (!stale)
+        {
+            _gaps++;
+        }
+        return;
+    }
+    _change_id = delta.change_id;
+
+    // the market traded through the resting orders
+    const auto& asks = _book.asks.levels();
+    while (!_bids.empty() && !asks.empty() && (_bids.begin()->first >= asks.begin()->first))
+    {
+        MockOrder& order = *_bids.begin()->second.front();
+        this->trade(order, _next_trade++, order.price, order.amount - order.filled, true, fills);
+        this->close(order, OrderState::Filled);
+    }
+
+    const auto& bids = _book.bids.levels();
+    while (!_asks.empty() && !bids.empty() && (_asks.begin()->first <= bids.begin()->first))
+    {
+        MockOrder& order = *_asks.begin()->second.front();
+        this->trade(order, _next_trade++, order.price, order.amount - order.filled, true, fills);
+        this->close(order, OrderState::Filled);
+    }
+}
+
+std::vector<const MockOrder*> MatchingEngine::open_orders(const std::string& account) const
+{
+    std::vector<const MockOrder*> orders;
+    for (const auto& it : _orders)
+    {
+        if (it.second->account == account)
+        {
+            orders.push_back(it.second.get());
+        }
+    }
+    std::sort(orders.begin(), orders.end(),
+        [](const MockOrder* a, const MockOrder* b) { return a->sequence < b->sequence; });
+    return orders;
+}
+
+double MatchingEngine::position(const std::string& account) const
+{
+    auto it = _positions.find(account);
+    return (it != _positions.end()) ? it->second : 0;
+}
+
+MockOrder* MatchingEngine::find(const std::string& account, const std::string& order_id)
+{
+    auto it = _orders.find(order_id);
+    if ((it == _orders.end()) || (it->second->account != account))
+    {
+        return nullptr;
+    }
+    return it->second.get();
+}
+
+void MatchingEngine::place(MockOrder& order, std::vector<Fill>& fills)
+{
+    if (!order.post_only)
+    {
+        this->match(order, fills);
+    }
+    else
+    {
+        double opposite;
+        if (this->best_opposite(order.direction, opposite))
+        {
+            if ((order.direction == Direction::Buy) && (order.price >= opposite))
+            {
+                order.price = opposite - _tick_size;
+            }
+            else if ((order.direction == Direction::Sell) && (order.price <= opposite))
+            {
+                order.price = opposite + _tick_size;
+            }
+        }
+    }
+
+    if (order.state == OrderState::Open)
+    {
+        this->rest(order);
+    }
+}
+
+// Walks the resting orders and the replayed levels on the other side
+// together, best price first, resting orders first at the same price
+void MatchingEngine::match(MockOrder& taker, std::vector<Fill>& fills)
+{
+    const bool buy = taker.direction == Direction::Buy;
+    const auto crosses = [buy, &taker](double price) { return buy ? price <= taker.price : price >= taker.price; };
+
+    // replayed levels within the limit price, taken from as the order fills
+    std::vector<std::pair<double, double>> market;
+    if (buy)
+    {
+        for (auto it = _book.asks.levels().begin(); (it != _book.asks.levels().end()) && crosses(it->first); ++it)
+        {
+            market.push_back(*it);
+        }
+    }
+    else
+    {
+        for (auto it = _book.bids.levels().begin(); (it != _book.bids.levels().end()) && crosses(it->first); ++it)
+        {
+            market.push_back(*it);
+        }
+    }
+    size_t level = 0;
+
+    while (taker.state == OrderState::Open)
+    {
+        const double remaining = taker.amount - taker.filled;
+        MockOrder* maker = this->best_resting(taker.direction);
+        const bool resting = (maker != nullptr) && crosses(maker->price) &&
+            ((level == market.size()) || (buy ? maker->price <= market[level].first : maker->price >= market[level].first));
+
+        if (resting)
+        {
+            const double amount = std::min(remaining, maker->amount - maker->filled);
+            const uint64_t trade_id = _next_trade++;
+            this->trade(*maker, trade_id, maker->price, amount, true, fills);
+            this->trade(taker, trade_id, maker->price, amount, false, fills);
+            if (maker->state != OrderState::Open)
+            {
+                this->close(*maker, maker->state);
+            }
+        }
+        else if (level < market.size())
+        {
+            const double amount = std::min(remaining, market[level].second);
+            this->trade(taker, _next_trade++, market[level].first, amount, false, fills);
+            market[level].second -= amount;
+            if (market[level].second <= 0)
+            {
+                level++;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+void MatchingEngine::rest(MockOrder& order)
+{
+    if (order.direction == Direction::Buy)
+    {
+        _bids[order.price].push_back(&order);
+    }
+    else
+    {
+        _asks[order.price].push_back(&order);
+    }
+}
+
+void MatchingEngine::unrest(MockOrder& order)
+{
+    const auto remove = [&order](auto& side)
+    {
+        auto level = side.find(order.price);
+        if (level == side.end())
+        {
+            return;
+        }
+        auto it = std::find(level->second.begin(), level->second.end(), &order);
+        if (it != level->second.end())
+        {
+            level->second.erase(it);
+        }
+        if (level->second.empty())
+        {
+            side.erase(level);
+        }
+    };
+
+    if (order.direction == Direction::Buy)
+    {
+        remove(_bids);
+    }
+    else
+    {
+        remove(_asks);
+    }
+}
+
+void MatchingEngine::trade(
+    MockOrder& order,
+    uint64_t trade_id,
+    double price,
+    double amount,
+    bool maker,
+    std::vector<Fill>& fills)
+{
+    order.filled += amount;
+    _positions[order.account] += (order.direction == Direction::Buy) ? amount : -amount;
+    if (order.filled >= order.amount)
+    {
+        order.state = OrderState::Filled;
+    }
+    fills.push_back({ order, trade_id, price, amount, maker });
+}
+
+void MatchingEngine::close(MockOrder& order, OrderState state)
+{
+    order.state = state;
+    this->unrest(order);
+
+    const std::string order_id = order.order_id;    // the order goes with its entry
+    _orders.erase(order_id);
+}
+
+MockOrder* MatchingEngine::best_resting(Direction direction) const
+{
+    if (direction == Direction::Buy)
+    {
+        return _asks.empty() ? nullptr : _asks.begin()->second.front();
+    }
+    return _bids.empty() ? nullptr : _bids.begin()->second.front();
+}
+
+bool MatchingEngine::best_opposite(Direction direction, double& price) const
+{
+    bool found = false;
+    if (direction == Direction::Buy)
+    {
+        if (!_asks.empty())
+        {
+            price = _asks.begin()->first;
+            found = true;
+        }
+        if (!_book.asks.levels().empty())
+        {
+            price = found ? std::min(price, _book.asks.levels().begin()->first) : _book.asks.levels().begin()->first;
+            found = true;
+        }
+    }
+    else
+    {
+        if (!_bids.empty())
+        {
+            price = _bids.begin()->first;
+            found = true;
+        }
+        if (!_book.bids.levels().empty())
+        {
+            price = found ? std::max(price, _book.bids.levels().begin()->first) : _book.bids.levels().begin()->first;
+            found = true;
+        }
+    }
+    return found;
+}
\ No newline at end of file
@@ -0,0 +1,151 @@
+#pragma once
+#include "book.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+enum class Direction : unsigned char
+{
+    Buy,
+    Sell
+};
+
+const char* direction_name(Direction);
+
+
+enum class OrderState : unsigned char
+{
+    Open,
+    Filled,
+    Cancelled
+};
+
+const char* order_state_name(OrderState);
+
+
+struct MockOrder
+{
+    std::string order_id;
+    std::string account;
+    std::string label;
+    Direction direction;
+    double price;
+    double amount;
+    double filled;
+    bool post_only;
+    OrderState state;
+    uint64_t sequence;          // time priority, renewed when the price changes
+};
+
+
+// One side of a trade, with the order as it stands after it
+struct Fill
+{
+    MockOrder order;
+    uint64_t trade_id;
+    double price;
+    double amount;
+    bool maker;
+};
+
+
+// Limit order book of one instrument. Orders of the clients rest in price-
+// time priority and trade with each other; the replayed market book stands
+// for everybody else. Incoming orders also take its liquidity (without
+// depleting it, the next update replaces it anyway), and resting orders the
+// market trades through are filled at their price.
+class MatchingEngine
+{
+public:
+    MatchingEngine(
+        const std::string&,         // instrument
+        double                      // tick size
+    );
+
+    // New limit order, as it stands once matched. A post-only order that
+    // would cross is moved one tick inside the other side instead, as the
+    // exchange does by default.
+    MockOrder submit(
+        const std::string&,         // account
+        Direction,
+        double,                     // amount
+        double,                     // price
+        bool,                       // post only
+        const std::string&,         // label
+        std::vector<Fill>&          // resulting fills (output)
+    );
+
+    // Changes a resting order, which keeps its time priority unless the
+    // price changes or the amount grows. False if the order is not open.
+    bool edit(
+        const std::string&,         // account
+        const std::string&,         // order id
+        double,                     // amount
+        double,                     // price
+        MockOrder&,                 // order once edited (output)
+        std::vector<Fill>&          // resulting fills (output)
+    );
+
+    bool cancel(
+        const std::string&,         // account
+        const std::string&,         // order id
+        MockOrder&                  // cancelled order (output)
+    );
+
+    // Applies a replayed book update and fills the orders it crosses. After
+    // a change id gap nothing is matched against the book until a snapshot
+    // or checkpoint restarts it.
+    void on_book(
+        const BookDelta&,
+        std::vector<Fill>&          // resulting fills (output)
+    );
+
+    std::vector<const MockOrder*> open_orders(const std::string&) const;
+    double position(const std::string&) const;
+
+    const std::string& instrument() const { return _instrument; }
+    const Book& book() const { return _book; }
+    int64_t change_id() const { return _change_id; }
+    size_t gaps() const { return _gaps; }
+
+private:
+    typedef std::deque<MockOrder*> Queue;
+
+    std::string _instrument;
+    double _tick_size;
+    Book _book;                     // replayed market
+    int64_t _change_id;
+    size_t _gaps;
+    std::unordered_map<std::string, std::unique_ptr<MockOrder>> _orders;   // open, by id
+    std::map<double, Queue, std::greater<double>> _bids;
+    std::map<double, Queue, std::less<double>> _asks;
+    std::unordered_map<std::string, double> _positions;
+    uint64_t _next_order;
+    uint64_t _next_sequence;
+    uint64_t _next_trade;
+
+    MockOrder* find(const std::string&, const std::string&);
+
+    // matches the order, or moves it off the other side if post-only, and
+    // rests what is left of it
+    void place(MockOrder&, std::vector<Fill>&);
+    void match(MockOrder&, std::vector<Fill>&);
+    void rest(MockOrder&);
+    void unrest(MockOrder&);
+    void trade(MockOrder&, uint64_t, double, double, bool, std::vector<Fill>&);
+    void close(MockOrder&, OrderState);
+
+    // first order in the queue on the other side of the direction
+    MockOrder* best_resting(Direction) const;
+
+    // best price on the other side of the direction, resting or replayed;
+    // false if it is empty
+    bool best_opposite(Direction, double&) const;
+};
\ No newline at end of file
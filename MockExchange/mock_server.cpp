@@ -0,0 +1,765 @@
+#include "mock_server.hpp"
+#include "request.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+
+namespace
+{
+    const char kHeartbeat[] = "{\"jsonrpc\":\"2.0\",\"method\":\"heartbeat\",\"params\":{\"type\":\"test_request\"}}";
+
+    int64_t now_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    OrderFields order_fields(const std::string& instrument, const MockOrder& order)
+    {
+        OrderFields fields;
+        fields.order_id = order.order_id.c_str();
+        fields.instrument = instrument.c_str();
+        fields.buy = (order.direction == Direction::Buy);
+        fields.state = order_state_name(order.state);
+        fields.price = order.price;
+        fields.amount = order.amount;
+        fields.filled = order.filled;
+        fields.post_only = order.post_only;
+        fields.label = order.label.c_str();
+        fields.timestamp = now_ms();
+        return fields;
+    }
+
+    void write_order(JsonWriter& w, const std::string& instrument, const MockOrder& order)
+    {
+        ::write_order(w, order_fields(instrument, order));
+    }
+
+    // points into the order fields and the trade id
+    TradeFields trade_fields(const Fill& fill, const OrderFields& order, const std::string& trade_id)
+    {
+        TradeFields trade;
+        trade.trade_id = trade_id.c_str();
+        trade.order = &order;
+        trade.price = fill.price;
+        trade.amount = fill.amount;
+        trade.maker = fill.maker;
+        trade.timestamp = order.timestamp;
+        return trade;
+    }
+
+    void write_trade(JsonWriter& w, const std::string& instrument, const Fill& fill)
+    {
+        const OrderFields order = order_fields(instrument, fill.order);
+        const std::string trade_id = std::to_string(fill.trade_id);
+        ::write_trade(w, trade_fields(fill, order, trade_id));
+    }
+}
+
+
+// ---------------------------------------------------------------
+// MockConnection
+// ---------------------------------------------------------------
+
+MockConnection::MockConnection(MockServer& server, tcp::socket&& socket, ssl::context& ctx) :
+    _server(server),
+    _ws(std::move(socket), ctx),
+    _writing(false),
+    _heartbeat(_ws.get_executor()),
+    _heartbeat_interval(0)
+{
+    _server.add(this);
+}
+
+MockConnection::~MockConnection()
+{
+    _server.remove(this);
+}
+
+void MockConnection::start()
+{
+    auto self = shared_from_this();
+    beast::get_lowest_layer(_ws).expires_after(std::chrono::seconds(30));
+    _ws.next_layer().async_handshake(ssl::stream_base::server, [self](beast::error_code ec)
+        {
+            if (ec)
+            {
+                std::cout << "TLS handshake failed: " << ec.message() << std::endl;
+                return;
+            }
+
+            beast::get_lowest_layer(self->_ws).expires_never();
+            self->_ws.set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+            self->_ws.async_accept([self](beast::error_code ec)
+                {
+                    if (ec)
+                    {
+                        std::cout << "Websocket handshake failed: " << ec.message() << std::endl;
+                        return;
+                    }
+                    self->_ws.text(true);
+                    self->do_read();
+                });
+        });
+}
+
+void MockConnection::do_read()
+{
+    _buffer.clear();
+    auto self = shared_from_this();
+    _ws.async_read(_buffer, [self](beast::error_code ec, std::size_t)
+        {
+            if (ec)
+            {
+                self->_heartbeat.cancel();  // nothing else holds the connection
+                return;
+            }
+
+            auto tail = self->_buffer.prepare(1);
+            *static_cast<char*>(tail.data()) = '\0';
+            self->_server.handle(*self, static_cast<char*>(self->_buffer.data().data()));
+
+            self->do_read();
+        });
+}
+
+void MockConnection::send(const std::string& msg)
+{
+    _outbox.push_back(msg);
+    if (!_writing)
+    {
+        this->do_write();
+    }
+}
+
+void MockConnection::do_write()
+{
+    _writing = true;
+    auto self = shared_from_this();
+    _ws.async_write(net::buffer(_outbox.front()), [self](beast::error_code ec, std::size_t)
+        {
+            self->_outbox.pop_front();
+            if (ec || self->_outbox.empty())
+            {
+                self->_writing = false;
+                return;
+            }
+            self->do_write();
+        });
+}
+
+void MockConnection::set_heartbeat(int interval)
+{
+    _heartbeat_interval = interval;
+    _heartbeat.cancel();
+    if (interval > 0)
+    {
+        this->arm_heartbeat();
+    }
+}
+
+void MockConnection::arm_heartbeat()
+{
+    _heartbeat.expires_after(std::chrono::seconds(_heartbeat_interval));
+    std::weak_ptr<MockConnection> weak = shared_from_this();
+    _heartbeat.async_wait([weak](beast::error_code ec)
+        {
+            auto self = weak.lock();
+            if (ec || !self || (self->_heartbeat_interval == 0))
+            {
+                return;
+            }
+            self->send(kHeartbeat);
+            self->arm_heartbeat();
+        });
+}
+
+bool MockConnection::subscribed(const std::string& channel) const
+{
+    return std::find(channels.begin(), channels.end(), channel) != channels.end();
+}
+
+
+// ---------------------------------------------------------------
+// MockServer
+// ---------------------------------------------------------------
+
+MockServer::MockServer(
+    net::io_context& ioc,
+    ssl::context& ctx,
+    const tcp::endpoint& endpoint,
+    const std::string& replay,
+    double speed,
+    double start,
+    double tick_size) :
+    _ioc(ioc),
+    _ssl(ctx),
+    _acceptor(ioc, endpoint),
+    _tick_size(tick_size),
+    _speed(speed),
+    _replaying(false),
+    _first_ns(0),
+    _timer(ioc),
+    _record(nullptr),
+    _orders(0),
+    _latency_total(0),
+    _latency_max(0)
+{
+    if (!replay.empty())
+    {
+        // paced here, on the timer, rather than by the replay itself
+        _replay.reset(new Replay(replay, 0, start));
+        _first_ns = _replay->now().ns;
+    }
+}
+
+void MockServer::start()
+{
+    std::cout << "Listening on " << _acceptor.local_endpoint() << std::endl;
+    this->do_accept();
+}
+
+void MockServer::do_accept()
+{
+    _acceptor.async_accept([this](beast::error_code ec, tcp::socket socket)
+        {
+            if (!ec)
+            {
+                socket.set_option(tcp::no_delay(true));
+                std::make_shared<MockConnection>(*this, std::move(socket), _ssl)->start();
+            }
+            this->do_accept();
+        });
+}
+
+void MockServer::add(MockConnection* connection)
+{
+    _connections.push_back(connection);
+}
+
+void MockServer::remove(MockConnection* connection)
+{
+    _connections.erase(std::remove(_connections.begin(), _connections.end(), connection), _connections.end());
+    this->print_stats();
+}
+
+void MockServer::print_stats() const
+{
+    if (_orders == 0)
+    {
+        return;
+    }
+    std::cout << "Tick to trade: " << _orders << " orders, "
+        << std::chrono::duration<double, std::micro>(_latency_total / _orders).count() << "us mean, "
+        << std::chrono::duration<double, std::micro>(_latency_max).count() << "us max" << std::endl;
+}
+
+MatchingEngine& MockServer::engine(const std::string& instrument)
+{
+    std::unique_ptr<MatchingEngine>& engine = _engines[instrument];
+    if (!engine)
+    {
+        engine.reset(new MatchingEngine(instrument, _tick_size));
+    }
+    return *engine;
+}
+
+// ---------------------------------------------------------------
+// replay
+// ---------------------------------------------------------------
+
+void MockServer::start_replay()
+{
+    if (!_replay || _replaying)
+    {
+        return;
+    }
+    _replaying = true;
+    _started = std::chrono::steady_clock::now();
+    this->next_record();
+}
+
+void MockServer::next_record()
+{
+    for (size_t batch = 0; (_record = _replay->next()) != nullptr; )
+    {
+        if (_record->type == RecordType::Channel)
+        {
+            ReplayChannel channel{ _replay->channel_name(_record->channel), nullptr };
+            if (channel.name.compare(0, 5, "book.") == 0)
+            {
+                const std::string instrument = channel.name.substr(5, channel.name.find('.', 5) - 5);
+                std::unique_ptr<MatchingEngine>& engine = _engines[instrument];
+                if (!engine)
+                {
+                    const double tick_size = _replay->tick_size(_record->channel);
+                    engine.reset(new MatchingEngine(instrument, tick_size > 0 ? tick_size : _tick_size));
+                }
+                channel.engine = engine.get();
+            }
+            if (static_cast<size_t>(_record->channel) >= _channels.size())
+            {
+                _channels.resize(_record->channel + 1);
+            }
+            _channels[_record->channel] = channel;
+            continue;
+        }
+
+        if (_speed > 0)
+        {
+            const auto due = _started + std::chrono::nanoseconds(
+                static_cast<int64_t>((_record->received.ns - _first_ns) / _speed));
+            if (due > std::chrono::steady_clock::now())
+            {
+                _timer.expires_at(due);
+                _timer.async_wait([this](beast::error_code ec)
+                    {
+                        if (!ec)
+                        {
+                            this->publish(*_record);
+                            this->next_record();
+                        }
+                    });
+                return;
+            }
+        }
+
+        this->publish(*_record);
+        if (++batch == kReplayBatch)
+        {
+            net::post(_ioc, [this]() { this->next_record(); });
+            return;
+        }
+    }
+
+    const Replay::Stats stats = _replay->stats();
+    size_t gaps = 0;
+    for (const auto& it : _engines)
+    {
+        gaps += it.second->gaps();
+    }
+    std::cout << "Replay finished: " << stats.notifications << " notifications, "
+        << stats.book_updates << " book updates, " << gaps << " book gaps" << std::endl;
+    this->print_stats();
+}
+
+void MockServer::publish(const Record& record)
+{
+    const ReplayChannel& channel = _channels[record.channel];
+    if (record.type == RecordType::Json)
+    {
+        this->broadcast(channel.name, record.json, record.json_length);
+        return;
+    }
+
+    if (record.checkpoint)
+    {
+        // restarts a book a gap left stale, the clients resync on their own
+        if ((channel.engine != nullptr) && channel.engine->book().stale())
+        {
+            channel.engine->on_book(record.book, _fills);
+            this->notify_fills(*channel.engine);
+        }
+        return;
+    }
+
+    if (channel.engine != nullptr)
+    {
+        channel.engine->on_book(record.book, _fills);
+    }
+
+    _data.str("");
+    _data << record.book;
+    const std::string& data = _data.str();
+    this->broadcast(channel.name, data.data(), data.size());
+    _last_tick = std::chrono::steady_clock::now();
+
+    if (channel.engine != nullptr)
+    {
+        this->notify_fills(*channel.engine);
+    }
+}
+
+void MockServer::broadcast(const std::string& channel, const char* data, size_t length)
+{
+    bool built = false;
+    for (MockConnection* connection : _connections)
+    {
+        if (!connection->subscribed(channel))
+        {
+            continue;
+        }
+        if (!built)
+        {
+            _message.assign("{\"jsonrpc\":\"2.0\",\"method\":\"subscription\",\"params\":{\"channel\":\"");
+            _message.append(channel);
+            _message.append("\",\"data\":");
+            _message.append(data, length);
+            _message.append("}}");
+            built = true;
+        }
+        connection->send(_message);
+    }
+}
+
+void MockServer::notify_fills(const MatchingEngine& engine)
+{
+    const std::string prefix = "user.changes." + engine.instrument() + ".";
+
+    for (const Fill& fill : _fills)
+    {
+        const OrderFields order = order_fields(engine.instrument(), fill.order);
+        const std::string trade_id = std::to_string(fill.trade_id);
+        const TradeFields trade = trade_fields(fill, order, trade_id);
+
+        for (MockConnection* connection : _connections)
+        {
+            if (connection->account != fill.order.account)
+            {
+                continue;
+            }
+            for (const std::string& channel : connection->channels)
+            {
+                if (channel.compare(0, prefix.size(), prefix) != 0)
+                {
+                    continue;
+                }
+
+                _out.Clear();
+                JsonWriter w(_out);
+                write_changes(w, channel.c_str(), trade, engine.position(fill.order.account));
+                connection->send(std::string(_out.GetString(), _out.GetSize()));
+            }
+        }
+    }
+    _fills.clear();
+}
+
+// ---------------------------------------------------------------
+// requests
+// ---------------------------------------------------------------
+
+void MockServer::handle(MockConnection& connection, char* msg)
+{
+    rapidjson::Document d;
+    d.ParseInsitu(msg);
+    if (d.HasParseError() || !d.IsObject() || !d.HasMember("method") || !d["method"].IsString())
+    {
+        std::cout << "Ignoring malformed request" << std::endl;
+        return;
+    }
+
+    const int64_t id = (d.HasMember("id") && d["id"].IsInt64()) ? d["id"].GetInt64() : 0;
+    const rapidjson::Value no_params(rapidjson::kObjectType);
+    const rapidjson::Value& params = (d.HasMember("params") && d["params"].IsObject()) ? d["params"] : no_params;
+
+    this->respond(connection, id, params, d["method"].GetString());
+}
+
+void MockServer::respond(MockConnection& connection, int64_t id, const rapidjson::Value& params, const std::string& name)
+{
+    const Method method = method_from_name(name);
+
+    if ((name.compare(0, 8, "private/") == 0) && connection.account.empty())
+    {
+        this->error(connection, id, 13009, "unauthorized");
+        return;
+    }
+
+    if ((method == Method::PrivateBuy) || (method == Method::PrivateSell) || (method == Method::PrivateEdit))
+    {
+        if (_last_tick != std::chrono::steady_clock::time_point())
+        {
+            const auto latency = std::chrono::steady_clock::now() - _last_tick;
+            _latency_total += latency;
+            _latency_max = std::max<std::chrono::nanoseconds>(_latency_max, latency);
+            _orders++;
+        }
+    }
+
+    _out.Clear();
+    JsonWriter w(_out);
+
+    switch (method)
+    {
+    case Method::PublicAuth:
+    {
+        const std::string grant = string_param(params, "grant_type");
+        std::string account;
+        if (grant == "client_credentials")
+        {
+            account = string_param(params, "client_id");
+        }
+        else if (grant == "refresh_token")
+        {
+            const std::string token = string_param(params, "refresh_token");
+            if (token.compare(0, 13, "mock-refresh-") == 0)
+            {
+                account = token.substr(13);
+            }
+        }
+        if (account.empty())
+        {
+            this->error(connection, id, 13004, "invalid_credentials");
+            return;
+        }
+        connection.account = account;
+
+        begin_response(w, id);
+        w.StartObject();
+        w.Key("access_token");
+        w.String(("mock-access-" + account).c_str());
+        w.Key("refresh_token");
+        w.String(("mock-refresh-" + account).c_str());
+        w.Key("expires_in");
+        w.Int(900);
+        w.Key("token_type");
+        w.String("bearer");
+        w.Key("scope");
+        w.String("connection mainaccount");
+        w.EndObject();
+        break;
+    }
+
+    case Method::PublicSubscribe:
+    {
+        if (!params.HasMember("channels") || !params["channels"].IsArray())
+        {
+            this->error(connection, id, -32602, "Invalid params");
+            return;
+        }
+        const auto& channels = params["channels"];
+        for (auto it = channels.Begin(); it != channels.End(); ++it)
+        {
+            if (it->IsString() && (std::strncmp(it->GetString(), "user.", 5) == 0) && connection.account.empty())
+            {
+                this->error(connection, id, 13009, "unauthorized");
+                return;
+            }
+        }
+
+        begin_response(w, id);
+        w.StartArray();
+        for (auto it = channels.Begin(); it != channels.End(); ++it)
+        {
+            if (!it->IsString())
+            {
+                continue;
+            }
+            if (!connection.subscribed(it->GetString()))
+            {
+                connection.channels.push_back(it->GetString());
+            }
+            w.String(it->GetString());
+        }
+        w.EndArray();
+        this->send_response(connection, w);
+        this->start_replay();
+        return;
+    }
+
+    case Method::PublicSetHeartbeat:
+    {
+        const double interval = number_param(params, "interval");
+        connection.set_heartbeat(std::isnan(interval) ? 0 : static_cast<int>(interval));
+        begin_response(w, id);
+        w.String("ok");
+        break;
+    }
+
+    case Method::PublicTest:
+        begin_response(w, id);
+        w.StartObject();
+        w.Key("version");
+        w.String("mock");
+        w.EndObject();
+        break;
+
+    case Method::PublicGetTime:
+        begin_response(w, id);
+        w.Int64(now_ms());
+        break;
+
+    case Method::PublicGetOrderBook:
+    {
+        const MatchingEngine& engine = this->engine(string_param(params, "instrument_name"));
+        const double depth = number_param(params, "depth");
+        const size_t levels = std::isnan(depth) ? 20 : static_cast<size_t>(depth);
+
+        begin_response(w, id);
+        w.StartObject();
+        w.Key("instrument_name");
+        w.String(engine.instrument().c_str());
+        w.Key("change_id");
+        w.Int64(engine.change_id());
+        w.Key("timestamp");
+        w.Int64(now_ms());
+        w.Key("bids");
+        w.StartArray();
+        size_t n = 0;
+        for (auto it = engine.book().bids.levels().begin(); (it != engine.book().bids.levels().end()) && (n < levels); ++it, ++n)
+        {
+            w.StartArray();
+            w.Double(it->first);
+            w.Double(it->second);
+            w.EndArray();
+        }
+        w.EndArray();
+        w.Key("asks");
+        w.StartArray();
+        n = 0;
+        for (auto it = engine.book().asks.levels().begin(); (it != engine.book().asks.levels().end()) && (n < levels); ++it, ++n)
+        {
+            w.StartArray();
+            w.Double(it->first);
+            w.Double(it->second);
+            w.EndArray();
+        }
+        w.EndArray();
+        w.EndObject();
+        break;
+    }
+
+    case Method::PrivateBuy:
+    case Method::PrivateSell:
+    {
+        const double amount = number_param(params, "amount");
+        const double price = number_param(params, "price");
+        if (!(amount > 0) || !(price > 0))
+        {
+            this->error(connection, id, -32602, "Invalid params");
+            return;
+        }
+
+        MatchingEngine& engine = this->engine(string_param(params, "instrument_name"));
+        const MockOrder order = engine.submit(
+            connection.account,
+            method == Method::PrivateBuy ? Direction::Buy : Direction::Sell,
+            amount, price, bool_param(params, "post_only"), string_param(params, "label"), _fills);
+        this->order_response(connection, id, engine, order);
+        return;
+    }
+
+    case Method::PrivateEdit:
+    {
+        const std::string order_id = string_param(params, "order_id");
+        const double amount = number_param(params, "amount");
+        const double price = number_param(params, "price");
+        if (!(amount > 0) || !(price > 0))
+        {
+            this->error(connection, id, -32602, "Invalid params");
+            return;
+        }
+
+        MockOrder order;
+        for (auto& it : _engines)
+        {
+            if (it.second->edit(connection.account, order_id, amount, price, order, _fills))
+            {
+                this->order_response(connection, id, *it.second, order);
+                return;
+            }
+        }
+        this->error(connection, id, 11044, "not_open_order");
+        return;
+    }
+
+    case Method::PrivateGetPosition:
+    {
+        const MatchingEngine& engine = this->engine(string_param(params, "instrument_name"));
+        const double size = engine.position(connection.account);
+
+        begin_response(w, id);
+        w.StartObject();
+        w.Key("instrument_name");
+        w.String(engine.instrument().c_str());
+        w.Key("kind");
+        w.String("future");
+        w.Key("size");
+        w.Double(size);
+        w.Key("direction");
+        w.String(size > 0 ? "buy" : (size < 0 ? "sell" : "zero"));
+        w.EndObject();
+        break;
+    }
+
+    case Method::PrivateGetOpenOrdersByInstrument:
+    {
+        const MatchingEngine& engine = this->engine(string_param(params, "instrument_name"));
+
+        begin_response(w, id);
+        w.StartArray();
+        for (const MockOrder* order : engine.open_orders(connection.account))
+        {
+            write_order(w, engine.instrument(), *order);
+        }
+        w.EndArray();
+        break;
+    }
+
+    case Method::PrivateCancel:
+    {
+        const std::string order_id = string_param(params, "order_id");
+        MockOrder order;
+        for (auto& it : _engines)
+        {
+            if (it.second->cancel(connection.account, order_id, order))
+            {
+                begin_response(w, id);
+                write_order(w, it.second->instrument(), order);
+                this->send_response(connection, w);
+                return;
+            }
+        }
+        this->error(connection, id, 11044, "not_open_order");
+        return;
+    }
+
+    default:
+        this->error(connection, id, -32601, "Method not found");
+        return;
+    }
+
+    this->send_response(connection, w);
+}
+
+void MockServer::order_response(MockConnection& connection, int64_t id, const MatchingEngine& engine, const MockOrder& order)
+{
+    _out.Clear();
+    JsonWriter w(_out);
+    begin_response(w, id);
+    w.StartObject();
+    w.Key("order");
+    write_order(w, engine.instrument(), order);
+    w.Key("trades");
+    w.StartArray();
+    for (const Fill& fill : _fills)
+    {
+        if (fill.order.order_id == order.order_id)
+        {
+            write_trade(w, engine.instrument(), fill);
+        }
+    }
+    w.EndArray();
+    w.EndObject();
+    this->send_response(connection, w);
+
+    // the resting orders it traded with, and its own fills, as notifications
+    this->notify_fills(engine);
+}
+
+void MockServer::error(MockConnection& connection, int64_t id, int code, const char* message)
+{
+    _out.Clear();
+    JsonWriter w(_out);
+    write_error(w, id, code, message);
+    connection.send(std::string(_out.GetString(), _out.GetSize()));
+}
+
+void MockServer::send_response(MockConnection& connection, JsonWriter& w)
+{
+    end_response(w);
+    connection.send(std::string(_out.GetString(), _out.GetSize()));
+}
\ No newline at end of file
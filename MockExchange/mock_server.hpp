@@ -0,0 +1,150 @@
+#pragma once
+#include "connection.hpp"
+#include "jsonrpc.hpp"
+#include "matching_engine.hpp"
+#include "replay.hpp"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+class MockServer;
+
+
+// Client connection of the mock server: TLS and websocket handshakes, then
+// one read in flight and queued writes, like an asynchronous WSSession
+class MockConnection : public std::enable_shared_from_this<MockConnection>
+{
+public:
+    MockConnection(
+        MockServer&,
+        tcp::socket&&,
+        ssl::context&
+    );
+    ~MockConnection();
+
+    void start();
+    void send(const std::string&);
+
+    // sends a heartbeat test request every interval, 0 to stop
+    void set_heartbeat(int);
+
+    bool subscribed(const std::string&) const;
+
+    std::string account;                // empty until authenticated
+    std::vector<std::string> channels;
+
+private:
+    MockServer& _server;
+    tcp_websocket _ws;
+    beast::flat_buffer _buffer;
+    std::deque<std::string> _outbox;
+    bool _writing;
+    net::steady_timer _heartbeat;
+    int _heartbeat_interval;
+
+    void do_read();
+    void do_write();
+    void arm_heartbeat();
+};
+
+
+// Stand-in for the exchange on the local machine. It answers the JSON-RPC
+// methods the sessions use, replays the book channels of a recording to
+// their subscribers and matches orders in a MatchingEngine per instrument,
+// sending the fills on the user.changes channels. Everything runs on the
+// thread running the io_context.
+class MockServer
+{
+public:
+    MockServer(
+        net::io_context&,
+        ssl::context&,              // server certificate and key
+        const tcp::endpoint&,       // to listen on
+        const std::string&,         // recording to replay, empty for none
+        double,                     // replay speed, 0 for as fast as possible
+        double,                     // seconds into the recording to start from
+        double                      // tick size of instruments not in the recording
+    );
+
+    void start();
+
+    // answers a request, parsed in place
+    void handle(
+        MockConnection&,
+        char*                       // message
+    );
+
+    void add(MockConnection*);
+    void remove(MockConnection*);
+
+    // time from the last book notification sent to the orders that follow
+    void print_stats() const;
+
+private:
+    // replayed notifications are sent in batches of this many when running
+    // as fast as possible, so that requests are read in between
+    static const size_t kReplayBatch = 64;
+
+    net::io_context& _ioc;
+    ssl::context& _ssl;
+    tcp::acceptor _acceptor;
+    double _tick_size;
+    std::vector<MockConnection*> _connections;
+    std::map<std::string, std::unique_ptr<MatchingEngine>> _engines;   // by instrument
+
+    // replay, started by the first subscription
+    struct ReplayChannel
+    {
+        std::string name;
+        MatchingEngine* engine;     // book channels only
+    };
+    std::unique_ptr<Replay> _replay;
+    double _speed;
+    bool _replaying;
+    int64_t _first_ns;
+    std::chrono::steady_clock::time_point _started;
+    net::steady_timer _timer;
+    const Record* _record;      // in hand, valid until the next one
+    std::vector<ReplayChannel> _channels;
+    std::ostringstream _data;
+    std::string _message;
+
+    // responses
+    rapidjson::StringBuffer _out;
+    std::vector<Fill> _fills;
+
+    // tick to trade
+    std::chrono::steady_clock::time_point _last_tick;
+    size_t _orders;
+    std::chrono::nanoseconds _latency_total;
+    std::chrono::nanoseconds _latency_max;
+
+    void do_accept();
+
+    void start_replay();
+    void next_record();
+    void publish(const Record&);
+    void broadcast(
+        const std::string&,         // channel
+        const char*,                // data
+        size_t                      // length
+    );
+
+    MatchingEngine& engine(const std::string&);
+
+    // sends the fills to the user.changes subscribers of their accounts
+    void notify_fills(const MatchingEngine&);
+
+    void respond(MockConnection&, int64_t, const rapidjson::Value&, const std::string&);
+    void order_response(MockConnection&, int64_t, const MatchingEngine&, const MockOrder&);
+    void error(MockConnection&, int64_t, int, const char*);
+
+    // closes a response begun with begin_response() and sends it
+    void send_response(MockConnection&, JsonWriter&);
+};
\ No newline at end of file